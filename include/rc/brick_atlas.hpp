@@ -0,0 +1,97 @@
+#ifndef RC_BRICK_ATLAS_HPP
+#define RC_BRICK_ATLAS_HPP
+
+#include <rc/world.hpp>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+namespace rc
+{
+	/*
+		Residency of the bricks of a world in an atlas with a fixed number of slots
+
+		Every brick has an entry in a table with the size of the brick grid. Uniform
+		bricks are described by the entry alone, as UNIFORM_BIT and their material.
+		Expanded bricks near the camera are copied into a free slot of the atlas
+		and their entry is the index of that slot. Other expanded bricks are stored
+		as a proxy of their most common solid material until they are close
+		enough, at which point the least recently used slot is reused for them.
+
+		A proxy is drawn at the resolution of the 4^3 nodes of the brick's
+		occupancy mask, which is uploaded next to every entry: nodes with a solid
+		block are solid and the others are empty. Far away surfaces therefore
+		keep their shape up to 4 blocks, but a node with a single solid block is
+		drawn as a full 4^3 cube and every block of a proxy has the same material.
+
+		This class only does the bookkeeping. The changed entries and the slots
+		that need to be filled are collected until clearChanges is called.
+	*/
+	class brick_atlas
+	{
+	public:
+		// The entry describes the whole brick as the material in its lowest byte
+		static const uint32_t UNIFORM_BIT = 0x80000000u;
+
+		// The entry describes an empty brick in a 64^3 region without any solid blocks
+		static const uint32_t EMPTY_REGION_BIT = 0x40000000u;
+
+		// The entry with UNIFORM_BIT is a proxy of an expanded brick that isn't resident, solid where its occupancy is
+		static const uint32_t PROXY_BIT = 0x20000000u;
+
+		// Maximum number of bricks copied into the atlas per update
+		static const int MAX_LOADS = 512;
+
+		brick_atlas();
+
+		// Start over with every brick of a world and slotsPerAxis^3 empty slots
+		void reset(const world& w, int slotsPerAxis);
+
+		// Update the entries of the bricks in a region of blocks that changed
+		void invalidate(const world& w, const box& region);
+
+		// Load the expanded bricks in the cube of slotsPerAxis^3 bricks around a position, nearest first
+		void update(const world& w, const glm::vec3& pos);
+
+		int slotsPerAxis() const { return slotAxis; }
+		int residentCount() const { return slotCount() - (int) freeSlots.size(); }
+		int slotCount() const { return slotAxis * slotAxis * slotAxis; }
+
+		// Entries in brick x, y, z order
+		const std::vector<uint32_t>& table() const { return entries; }
+
+		// Brick that a slot holds, in brick coordinates, or -1 if the slot is free
+		glm::ivec3 slotBrick(int slot) const;
+
+		// Origin of a slot in the atlas, in blocks
+		glm::ivec3 slotOrigin(int slot) const;
+
+		// Regions of the brick grid whose entries changed and slots that need new data since the last clearChanges
+		const std::vector<box>& changedEntries() const { return changed; }
+		const std::vector<int>& loadedSlots() const { return loaded; }
+		void clearChanges();
+
+	private:
+		int bsx, bsy, bsz;
+		int slotAxis;
+
+		std::vector<uint32_t> entries;
+
+		// Brick index per slot, -1 if it's free, and the update that last needed it
+		std::vector<int> slotBricks;
+		std::vector<uint64_t> slotUsed;
+		std::vector<int> freeSlots;
+		uint64_t frame;
+
+		std::vector<box> changed;
+		std::vector<int> loaded;
+
+		int toBrickIndex(int bx, int by, int bz) const { return (bz * bsy + by) * bsx + bx; }
+
+		uint32_t describeBrick(const world& w, int bx, int by, int bz) const;
+		void setEntry(int bx, int by, int bz, uint32_t entry);
+		void freeSlot(int slot);
+	};
+}
+
+#endif
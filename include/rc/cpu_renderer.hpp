@@ -0,0 +1,71 @@
+#ifndef RC_CPU_RENDERER_HPP
+#define RC_CPU_RENDERER_HPP
+
+#include <rc/world.hpp>
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace rc
+{
+	template <typename Layout>
+	class cpu_tracer;
+
+	/*
+		Software implementation of the ray tracer in renderer.frag
+
+		The frame is split into tiles that are rendered on all cores. The result is
+		an RGBA8 framebuffer with the top row first.
+	*/
+	class cpu_renderer
+	{
+	public:
+		cpu_renderer(int width, int height);
+
+		template <typename Layout>
+		void setWorld(const basic_world<Layout>& w);
+
+		void setSkyColor(const glm::vec3& color);
+
+		void setCameraDir(const glm::vec3& pos, const glm::vec3& dir, float fov, float aspect);
+		void setCameraTarget(const glm::vec3& pos, const glm::vec3& target, float fov, float aspect);
+
+		// Number of threads of the shared job pool to render with, 0 uses all of them
+		void setThreadCount(int threads);
+
+		void drawFrame();
+
+		int width() const;
+		int height() const;
+		const uint8_t* pixels() const;
+
+		// Rays traced for the last frame, including shadow and reflection rays
+		uint64_t rayCount() const;
+
+	private:
+		template <typename Layout>
+		friend class cpu_tracer;
+
+		typedef void (*tile_func)(cpu_renderer& r, int x0, int y0, int x1, int y1, uint64_t& rays);
+
+		int frameWidth, frameHeight;
+		std::vector<uint8_t> framebuffer;
+		int threadCount;
+		uint64_t rays;
+
+		const void* currentWorld;
+		tile_func renderTile;
+		int maxIterations;
+
+		glm::vec4 skyColor;
+		glm::vec3 viewOrigin;
+		glm::mat4 invProjView;
+
+		std::vector<uint8_t> materials;
+		int materialsWidth, materialsHeight;
+		float materialCount;
+
+		void loadMaterialTexture();
+	};
+}
+
+#endif
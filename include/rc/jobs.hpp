@@ -0,0 +1,124 @@
+#ifndef RC_JOBS_HPP
+#define RC_JOBS_HPP
+
+#include <rc/world.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rc
+{
+	namespace jobs
+	{
+		struct task_state;
+
+		typedef std::function<void()> task_func;
+		typedef std::function<void(const box& chunk)> range_func;
+		typedef std::function<void(int begin, int end)> index_func;
+
+		/*
+			Handle to a submitted task, an empty handle counts as finished
+		*/
+		class task
+		{
+		public:
+			task() {}
+
+			bool done() const;
+
+		private:
+			friend class pool;
+
+			std::shared_ptr<task_state> state;
+
+			task(const std::shared_ptr<task_state>& state) : state(state) {}
+		};
+
+		/*
+			Fixed set of threads that run tasks with work stealing
+
+			Every worker has its own deque of tasks. It pushes and pops tasks at the
+			back, so it continues with the work it created most recently, and a worker
+			that runs out of tasks steals the oldest ones from the front of the other
+			deques. Tasks submitted from threads outside of the pool go into a deque
+			that is only stolen from.
+
+			A thread that waits for a task runs other tasks in the meantime. This makes
+			the thread calling parallelFor one of the threads doing the work and lets
+			tasks wait for other tasks without running out of workers. A pool of a
+			single thread has no workers and only runs tasks while they're waited on.
+		*/
+		class pool
+		{
+		public:
+			// Chunks per thread when parallelFor picks the chunk size
+			static const int CHUNKS_PER_THREAD = 4;
+
+			// Run tasks on up to threads threads including the one waiting for them, 0 uses all cores
+			explicit pool(int threads = 0);
+
+			// Finishes the tasks that are queued before stopping the workers
+			~pool();
+
+			int threadCount() const;
+
+			// Queue a task that runs once all of its dependencies have finished
+			task submit(const task_func& func);
+			task submit(const task_func& func, const task& dependency);
+			task submit(const task_func& func, const std::vector<task>& dependencies);
+
+			// Block until a task has finished, running other tasks in the meantime
+			void wait(const task& t);
+			void wait(const std::vector<task>& tasks);
+
+			// Call func with chunks of up to chunk indices that together cover range, on up to maxThreads threads
+			// or all of them if 0. Components of chunk that are 0 are picked to split the range along z, y and
+			// then x into about CHUNKS_PER_THREAD chunks per thread.
+			void parallelFor(const box& range, const glm::ivec3& chunk, const range_func& func, int maxThreads = 0);
+			void parallelFor(int begin, int end, int chunk, const index_func& func, int maxThreads = 0);
+
+		private:
+			struct queue
+			{
+				std::mutex mutex;
+				std::deque<std::shared_ptr<task_state>> tasks;
+			};
+
+			int threads;
+			std::vector<std::thread> workers;
+
+			// Deque per worker followed by the one for other threads
+			std::vector<std::unique_ptr<queue>> queues;
+
+			// Tasks in all deques, workers sleep while there are none
+			std::atomic<int> queued;
+			std::atomic<int> waiting;
+			bool stopping;
+			std::mutex sleepMutex;
+			std::condition_variable wake;
+
+			pool(const pool&);
+			pool& operator=(const pool&);
+
+			// Index of the deque of the calling thread
+			int queueIndex() const;
+
+			void push(const std::shared_ptr<task_state>& t);
+			std::shared_ptr<task_state> findTask(int self);
+			void run(const std::shared_ptr<task_state>& t);
+
+			void workerLoop(int index);
+		};
+
+		// Pool with a thread per core that is shared by the world and the renderers, created on first use
+		pool& shared();
+	}
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef RC_LAYOUT_HPP
+#define RC_LAYOUT_HPP
+
+namespace rc
+{
+	/*
+		Orders of the blocks inside a 16x16x16 brick of a world
+
+		Each layout maps local coordinates in the range [0, 16) to a unique offset
+		in the range [0, 4096).
+	*/
+	namespace layout
+	{
+		// Rows along x, stacked along y and then z
+		struct linear
+		{
+			static const int ID = 0;
+			static const bool CONTIGUOUS_ROWS = true;
+
+			static const char* name() { return "linear"; }
+
+			static int offset(int x, int y, int z)
+			{
+				return (z << 8) | (y << 4) | x;
+			}
+		};
+
+		// Z-order curve, interleaves the bits of the coordinates so that all three axes stay local
+		struct morton
+		{
+			static const int ID = 1;
+			static const bool CONTIGUOUS_ROWS = false;
+
+			static const char* name() { return "morton"; }
+
+			static int offset(int x, int y, int z)
+			{
+				return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+			}
+
+		private:
+			static int spread(int v)
+			{
+				return (v & 1) | ((v & 2) << 2) | ((v & 4) << 4) | ((v & 8) << 6);
+			}
+		};
+
+		// Linear 4x4x4 tiles, each tile being 64 bytes and thus a single cache line
+		struct tiled
+		{
+			static const int ID = 2;
+			static const bool CONTIGUOUS_ROWS = false;
+
+			static const char* name() { return "tiled"; }
+
+			static int offset(int x, int y, int z)
+			{
+				int tile = ((z >> 2) << 4) | ((y >> 2) << 2) | (x >> 2);
+				int local = ((z & 3) << 4) | ((y & 3) << 2) | (x & 3);
+
+				return (tile << 6) | local;
+			}
+		};
+	}
+}
+
+#endif
@@ -2,9 +2,12 @@
 #define RC_RENDERER_HPP
 
 #include <rc/world.hpp>
+#include <rc/brick_atlas.hpp>
 #include <glm/glm.hpp>
 #include <GL3/gl3w.h>
+#include <map>
 #include <string>
+#include <vector>
 
 namespace rc
 {
@@ -14,31 +17,147 @@ namespace rc
 		renderer();
 		~renderer();
 
+		// The distance field of the world is used if it has been built before
 		void setWorld(world& w);
+
+		// Render the next world through a brick atlas with room for slotsPerAxis^3 expanded bricks. With 0 the
+		// atlas is only used for worlds that exceed the 3D texture size limit.
+		void setBrickAtlas(int slotsPerAxis);
 		void setSkyColor(const glm::vec3& color);
 
+		// Trace rays towards the light for shadows and off gold blocks for reflections, both enabled by default
+		void setShadows(bool enabled);
+		void setReflections(bool enabled);
+
 		void setCameraDir(const glm::vec3& pos, const glm::vec3& dir, float fov, float aspect);
 		void setCameraTarget(const glm::vec3& pos, const glm::vec3& target, float fov, float aspect);
 
-		void drawFrame() const;
+		void drawFrame();
+
+		// Find the block under a pixel in window coordinates and the normal of the face that was hit, traced on
+		// the CPU so that it never waits for the GPU. Use requestHit to read hits from the hit buffer instead.
+		bool pick(int x, int y, glm::vec3& pos, glm::vec3& normal) const;
+
+		// Also render the block, face and distance hit by every pixel into a second buffer, at the current viewport size
+		void setHitBuffer(bool enabled);
+
+		// Read the hit under a pixel in window coordinates back from the hit buffer after the next frame
+		void requestHit(int x, int y);
 
-		void pick(int x, int y, glm::vec3& pos, glm::vec3& normal) const;
+		// Get the result of the last request without waiting, returns false until the GPU has finished it
+		bool pollHit(ray_hit& result);
+
+		// Highlight the block under a pixel in window coordinates, negative coordinates disable it
+		void setHighlight(int x, int y);
 
 	private:
-		GLuint vertexShader, fragmentShader, shaderProgram;
+		// Shader variants by their defines and the one in use
+		std::string vertexSource, fragmentSource;
+		std::string shaderDirectory;
+		std::string driverVersion;
+		std::map<std::string, GLuint> programs;
+		std::string programDefines;
+		GLuint shaderProgram;
+		bool shadows, reflections;
+		int materialCount;
+
 		GLuint vertexArray, vertexBuffer;
 		GLuint blockDataTexture;
+		GLuint occupancyTexture;
+		GLuint distanceTexture;
+		world* currentWorld;
+
+		// Indirection table and atlas of bricks near the camera, instead of a texture with every block
+		GLuint brickTableTexture, brickAtlasTexture;
+		brick_atlas atlas;
+		int atlasSlots;
+		bool useBrickAtlas;
+		uint64_t worldCursor;
 		GLuint materialsTexture;
-		GLuint pickFramebuffer, pickColorbuffer;
+
+		// State in the std140 layout of the renderState block in renderer.frag, uploaded once per frame if it changed
+		struct render_state
+		{
+			glm::mat4 invProjView;
+			glm::vec3 viewOrigin;
+			GLfloat padding0;
+			glm::vec4 skyColor;
+			glm::ivec3 highlightBlock;
+			GLint padding1;
+		};
+
+		render_state state;
+		GLuint stateBuffer;
+		bool stateChanged;
+
+		// Hit buffer with the primary hit of the last frame
+		GLuint hitFramebuffer, hitColorbuffer, hitBuffer, hitDepthBuffer;
+		int hitWidth, hitHeight;
+
+		// Pixel of the hit buffer being copied into a pixel buffer without waiting for the GPU
+		struct hit_readback
+		{
+			GLuint pixelBuffer;
+			GLsync fence;
+			int x, y;
+			bool requested;
+		};
+
+		hit_readback requestedHit, highlightHit;
+		bool highlightEnabled;
+
+		// Textures that world changes are uploaded to
+		enum upload_target { BLOCK_DATA, OCCUPANCY, DISTANCES, BRICK_TABLE, BRICK_ATLAS };
+
+		// Region of a texture waiting in a staging buffer, at an offset in bytes
+		struct texture_upload
+		{
+			upload_target target;
+			box region;
+			size_t offset;
+
+			texture_upload(upload_target target, const box& region) : target(target), region(region), offset(0) {}
+		};
+
+		// Ring of pixel buffers that uploads are staged in, each one is reused once the GPU is done with it. Persistent
+		// mapping needs GL 4.4, so on the 3.3 context a buffer is mapped unsynchronized for every flush, behind a fence.
+		static const int STAGING_BUFFERS = 3;
+		GLuint stagingBuffers[STAGING_BUFFERS];
+		GLsync stagingFences[STAGING_BUFFERS];
+		size_t stagingSizes[STAGING_BUFFERS];
+		int stagingIndex;
 
 		void initShaders();
-		GLuint loadShader(const std::string& path, GLenum type);
+		void initState();
+		std::string loadShaderSource(const std::string& path);
+		GLuint compileShader(const std::string& source, const std::string& defines, GLenum type);
+
+		std::string variantDefines() const;
+		GLuint buildProgram(const std::string& defines);
+		bool checkProgram(GLuint program, const std::string& defines);
+		GLuint loadProgramBinary(const std::string& path, const std::string& key);
+		void saveProgramBinary(GLuint program, const std::string& path, const std::string& key);
+		void useVariant();
 
 		void initVertexData();
 
-		void initPickFramebuffer();
+		void initHitBuffer();
+		void destroyHitBuffer();
+		void queueReadback(hit_readback& readback);
+		bool pollReadback(hit_readback& readback, ray_hit& result);
 
 		void loadMaterialTexture();
+
+		void initStaging();
+		void uploadTextures(const std::vector<texture_upload>& uploads);
+		void flushStaging(std::vector<texture_upload>& pending);
+		void copyTexels(upload_target target, const box& region, uint8_t* out) const;
+		// Entries of the brick table are followed by the low and high half of the occupancy of their brick
+		static size_t texelSize(upload_target target) { return target == BRICK_TABLE ? 3 * sizeof(uint32_t) : 1; }
+		void queueAtlasUploads(std::vector<texture_upload>& uploads);
+
+		void uploadWorld();
+		void syncWorld();
 	};
 }
 
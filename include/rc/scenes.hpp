@@ -0,0 +1,29 @@
+#ifndef RC_SCENES_HPP
+#define RC_SCENES_HPP
+
+#include <rc/world.hpp>
+#include <glm/glm.hpp>
+#include <string>
+
+namespace rc
+{
+	/*
+		Named test worlds with a deterministic camera path through each of them
+
+		Scenes are generated from fixed seeds, so the same name and world size
+		always produce the same blocks and camera positions.
+	*/
+	namespace scenes
+	{
+		// Names of the available scenes, terminated by nullptr
+		extern const char* const names[];
+
+		// Fill a world with a scene, returns false if there is no scene with that name
+		bool build(const std::string& name, world& w);
+
+		// Camera position and target for a frame of a path that loops after frameCount frames
+		void cameraPath(const std::string& name, const world& w, int frame, int frameCount, glm::vec3& pos, glm::vec3& target);
+	}
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,150 @@
+#ifndef RC_STREAMED_WORLD_HPP
+#define RC_STREAMED_WORLD_HPP
+
+#include <rc/world_file.hpp>
+#include <rc/jobs.hpp>
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace rc
+{
+	/*
+		Blocks of a world that is larger than memory, streamed brick by brick from
+		a world file
+
+		This is only a store of blocks with get and set, not a basic_world. It
+		has no raycast, change journal or distance field, so the renderers and
+		tracers can't use it directly.
+
+		Up to a fixed number of bricks are kept decoded in memory. A brick that
+		isn't is read from the file on the first get or set that needs it, after
+		the brick that was used least recently has been evicted to make room.
+		Evicted bricks that were changed are written back to the file, so only
+		files that are opened for writing can be changed. A changed brick that
+		can't be written back stays in memory, even if that exceeds the capacity.
+
+		prefetch queues reads of the bricks around the camera as tasks of the
+		shared job pool and returns right away. They're decoded while the caller
+		keeps working, and a get or set that needs a brick that is still being
+		read waits for that read instead of starting another one. A pool with a
+		single thread has no workers to read ahead on, so prefetch does nothing.
+	*/
+	class streamed_world
+	{
+	public:
+		// Bricks read ahead by a single task of the job pool
+		static const int READS_PER_TASK = 8;
+
+		struct counters
+		{
+			// Gets and sets that found their brick in memory or read ahead, that had to read it,
+			// and that had to wait for a read ahead that hadn't finished yet
+			uint64_t hits;
+			uint64_t misses;
+			uint64_t waits;
+
+			// Bricks removed to make room, changed bricks written back to the file and changed bricks that
+			// couldn't be written back
+			uint64_t evictions;
+			uint64_t writes;
+			uint64_t failedWrites;
+
+			// Reads queued by prefetch and those of them that were cancelled because the camera moved away
+			uint64_t prefetched;
+			uint64_t cancelled;
+		};
+
+		// Stream the bricks of an open file, keeping up to capacity of them in memory
+		streamed_world(world_file& file, size_t capacity);
+
+		// Finishes reads ahead and writes back changed bricks
+		~streamed_world();
+
+		int sizeX() const;
+		int sizeY() const;
+		int sizeZ() const;
+
+		material::material_t get(int x, int y, int z);
+
+		// False if the block is outside of the world or the file isn't writable
+		bool set(int x, int y, int z, material::material_t mat);
+
+		// Queue reads of the bricks within radius blocks of where the camera is going to be that aren't in memory
+		// yet, nearest first and with at most half the capacity being read at once. Reads of earlier calls that are
+		// outside of the radius now are cancelled. Does nothing if the shared pool has no workers.
+		void prefetch(const glm::vec3& camera, float radius);
+
+		// Write all changed bricks back to the file, false if one of them couldn't be written
+		bool flush();
+
+		size_t capacity() const;
+		size_t residentBricks() const;
+
+		const counters& stats() const;
+		void resetStats();
+
+	private:
+		struct brick
+		{
+			// Blocks in the order of the layout of the file, empty if the brick is uniform
+			std::vector<uint8_t> blocks;
+			material::material_t uniform;
+			bool dirty;
+
+			// Position in the list of recently used bricks
+			std::list<int>::iterator used;
+		};
+
+		// Brick being read ahead by a task, which skips the read if it's cancelled before the task gets to it
+		struct read_ahead
+		{
+			std::unique_ptr<brick> b;
+			std::atomic<bool> cancelled;
+			std::atomic<bool> ready;
+			jobs::task task;
+		};
+
+		world_file& file;
+		size_t maxBricks;
+
+		std::unordered_map<int, std::unique_ptr<brick>> bricks;
+		std::unordered_map<int, std::shared_ptr<read_ahead>> reading;
+
+		// Tasks of cancelled reads, which still have to finish before the world is destroyed
+		std::vector<jobs::task> cancelledTasks;
+
+		// Most recently used brick first
+		std::list<int> recent;
+
+		// Brick of the last access, which nearby accesses are likely to use again
+		int lastIndex;
+		brick* last;
+
+		// Brick offset of every block in the layout of the file
+		std::vector<uint16_t> offsets;
+
+		counters counts;
+
+		streamed_world(const streamed_world&);
+		streamed_world& operator=(const streamed_world&);
+
+		// Brick of a block inside the world, read from the file if needed
+		brick& fetch(int x, int y, int z);
+
+		// Add a decoded brick, evicting the least recently used bricks if there's no room
+		brick& insert(int index, std::unique_ptr<brick> b);
+
+		// Evict the least recently used brick that is unchanged or can be written back, false if there's none
+		bool evict();
+		bool writeBack(int index, brick& b);
+
+		bool readBrick(int index, brick& b) const;
+		int offset(int x, int y, int z) const;
+	};
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef RC_TERRAIN_HPP
+#define RC_TERRAIN_HPP
+
+#include <rc/world.hpp>
+#include <cstdint>
+
+namespace rc
+{
+	/*
+		Lattice noise shared by the terrain generator and the scenes
+	*/
+	namespace noise
+	{
+		// Well mixed hash of a point of the integer lattice
+		uint32_t hashLattice(int x, int y, int z, uint32_t seed);
+
+		// Pseudo-random value in [0, 1) for a point of the integer lattice
+		float latticeValue(int x, int y, int z, uint32_t seed);
+
+		// Smoothly interpolated lattice values in a plane or in space, in [0, 1)
+		float valueNoise(float px, float py, uint32_t seed);
+		float valueNoise(const glm::vec3& p, uint32_t seed);
+	}
+
+	/*
+		Seeded generator of hills with caves and trees
+
+		The ground is a fractal heightmap of grass on stone with beaches of sand
+		in the valleys. Caves are carved out of the stone below the surface from
+		3D noise that is sampled every few blocks and interpolated in between.
+		Trees stand on a jittered grid so that their leaves never overlap.
+
+		Every block only depends on the seed and its coordinates, so columns are
+		generated independently on all cores and the same seed always results in
+		the same world, whatever the number of threads.
+	*/
+	class terrain_generator
+	{
+	public:
+		terrain_generator(uint32_t seed);
+
+		// Number of worker threads, 0 uses all cores
+		void setThreadCount(int threads);
+
+		// Replace every block of a world with terrain scaled to its height
+		void generate(world& w) const;
+
+		// Number of ground blocks in a column of a world that is sz blocks high, before caves are carved out
+		int groundHeight(int x, int y, int sz) const;
+
+	private:
+		uint32_t seed;
+		int threadCount;
+
+		void generateColumn(int x0, int y0, int sz, int height, uint8_t* blocks) const;
+		void placeTrees(int x0, int y0, int sz, uint8_t* blocks) const;
+	};
+}
+
+#endif
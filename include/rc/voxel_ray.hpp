@@ -0,0 +1,185 @@
+#ifndef RC_VOXEL_RAY_HPP
+#define RC_VOXEL_RAY_HPP
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace rc
+{
+	/*
+		Incremental traversal of the blocks that a ray passes through in a grid
+		of the given size (Amanatides & Woo)
+
+		Every step moves to the neighbouring block across the nearest block
+		boundary, so each block is visited exactly once and the entry point and
+		face follow directly from the traversal state.
+	*/
+	class voxel_ray
+	{
+	public:
+		// Starts in the block containing origin, or where the ray enters the grid if origin lies outside of it
+		voxel_ray(const glm::vec3& origin, const glm::vec3& dir, const glm::ivec3& size) : origin(origin), dir(dir), size(size)
+		{
+			const float inf = std::numeric_limits<float>::infinity();
+
+			faceNormal = glm::ivec3(0);
+			t = 0.0f;
+
+			if (origin.x >= 0.0f && origin.y >= 0.0f && origin.z >= 0.0f && origin.x <= size.x && origin.y <= size.y && origin.z <= size.z) {
+				startInside = true;
+				valid = true;
+			} else {
+				startInside = false;
+				valid = intersectBox(origin, dir, glm::vec3(0.0f), glm::vec3(size), t, faceNormal);
+			}
+
+			// Block containing the start point, clamped because the point may lie on the far side of the grid
+			cell = glm::clamp(glm::ivec3(glm::floor(origin + dir * t)), glm::ivec3(0), size - 1);
+
+			for (int i = 0; i < 3; i++) {
+				stepDir[i] = dir[i] > 0.0f ? 1 : (dir[i] < 0.0f ? -1 : 0);
+				tDelta[i] = dir[i] != 0.0f ? std::abs(1.0f / dir[i]) : inf;
+			}
+
+			updateBoundaries();
+		}
+
+		// Find where a ray enters a box and the normal of the face it enters through
+		static bool intersectBox(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3& boxMin, const glm::vec3& boxMax, float& tEnter, glm::ivec3& normal)
+		{
+			float tNear = -std::numeric_limits<float>::infinity();
+			float tFar = std::numeric_limits<float>::infinity();
+			int axis = 0;
+
+			for (int i = 0; i < 3; i++) {
+				if (dir[i] == 0.0f) {
+					if (origin[i] < boxMin[i] || origin[i] > boxMax[i]) return false;
+					continue;
+				}
+
+				float t0 = (boxMin[i] - origin[i]) / dir[i];
+				float t1 = (boxMax[i] - origin[i]) / dir[i];
+				if (t0 > t1) std::swap(t0, t1);
+
+				if (t0 > tNear) {
+					tNear = t0;
+					axis = i;
+				}
+
+				tFar = std::min(tFar, t1);
+			}
+
+			if (tNear > tFar || tFar < 0.0f) return false;
+
+			tEnter = std::max(tNear, 0.0f);
+			normal = glm::ivec3(0);
+			normal[axis] = dir[axis] > 0.0f ? -1 : 1;
+
+			return true;
+		}
+
+		// Move to the next block along the ray
+		void step()
+		{
+			int axis;
+
+			if (tMax.x <= tMax.y && tMax.x <= tMax.z)
+				axis = 0;
+			else if (tMax.y <= tMax.z)
+				axis = 1;
+			else
+				axis = 2;
+
+			cell[axis] += stepDir[axis];
+			t = tMax[axis];
+			tMax[axis] += tDelta[axis];
+
+			faceNormal = glm::ivec3(0);
+			faceNormal[axis] = -stepDir[axis];
+		}
+
+		// Move to the first block past an axis aligned box around the current block, like a node known to be empty
+		void skip(const glm::ivec3& boxMin, const glm::ivec3& boxMax)
+		{
+			const float inf = std::numeric_limits<float>::infinity();
+
+			// Find the side through which the ray leaves the box
+			float tExit = inf;
+			int axis = 0;
+
+			for (int i = 0; i < 3; i++) {
+				if (stepDir[i] == 0) continue;
+
+				float ti = ((stepDir[i] > 0 ? boxMax[i] : boxMin[i]) - origin[i]) / dir[i];
+
+				if (ti < tExit) {
+					tExit = ti;
+					axis = i;
+				}
+			}
+
+			t = std::max(t, tExit);
+			glm::vec3 pos = position();
+
+			// The exit point lies on the box, so only the exit axis leaves it
+			for (int i = 0; i < 3; i++)
+				cell[i] = glm::clamp(int(std::floor(pos[i])), boxMin[i], boxMax[i] - 1);
+
+			cell[axis] = stepDir[axis] > 0 ? boxMax[axis] : boxMin[axis] - 1;
+
+			faceNormal = glm::ivec3(0);
+			faceNormal[axis] = -stepDir[axis];
+
+			updateBoundaries();
+		}
+
+		// Ray hits the grid at all
+		bool hitsGrid() const { return valid; }
+
+		// Traversal started in the block containing the origin rather than on the grid boundary
+		bool startedInside() const { return startInside; }
+
+		// Current block lies inside the grid
+		bool inside() const
+		{
+			return cell.x >= 0 && cell.y >= 0 && cell.z >= 0 && cell.x < size.x && cell.y < size.y && cell.z < size.z;
+		}
+
+		const glm::ivec3& block() const { return cell; }
+
+		// Normal of the face through which the current block was entered, zero for a start block containing the origin
+		const glm::ivec3& normal() const { return faceNormal; }
+
+		// Distance along the ray in units of dir at which the current block was entered
+		float distance() const { return t; }
+
+		glm::vec3 position() const { return origin + dir * t; }
+
+	private:
+		// Distances along the ray to the far boundaries of the current block
+		void updateBoundaries()
+		{
+			for (int i = 0; i < 3; i++) {
+				if (stepDir[i] > 0)
+					tMax[i] = (cell[i] + 1 - origin[i]) / dir[i];
+				else if (stepDir[i] < 0)
+					tMax[i] = (cell[i] - origin[i]) / dir[i];
+				else
+					tMax[i] = std::numeric_limits<float>::infinity();
+			}
+		}
+
+		glm::vec3 origin, dir;
+		glm::ivec3 size;
+
+		glm::ivec3 cell, stepDir, faceNormal;
+		glm::vec3 tMax, tDelta;
+		float t;
+
+		bool valid, startInside;
+	};
+}
+
+#endif
@@ -1,8 +1,14 @@
 #ifndef RC_WORLD_HPP
 #define RC_WORLD_HPP
 
-#include <vector>
+#include <rc/layout.hpp>
+#include <glm/glm.hpp>
+
 #include <functional>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
 
 namespace rc
 {
@@ -11,7 +17,7 @@ namespace rc
 	*/
 	namespace material
 	{
-		enum material_t
+		enum material_t : uint8_t
 		{
 			EMPTY,
 			GRASS,
@@ -24,34 +30,430 @@ namespace rc
 		};
 	}
 
+	/*
+		Read-only view of raw block storage, one byte per block
+	*/
+	class block_span
+	{
+	public:
+		block_span(const uint8_t* ptr, size_t count) : ptr(ptr), count(count) {}
+
+		material::material_t operator[](size_t i) const { return material::material_t(ptr[i]); }
+
+		const uint8_t* data() const { return ptr; }
+		size_t size() const { return count; }
+		size_t sizeBytes() const { return count * sizeof(uint8_t); }
+		bool empty() const { return count == 0; }
+
+		const uint8_t* begin() const { return ptr; }
+		const uint8_t* end() const { return ptr + count; }
+
+	private:
+		const uint8_t* ptr;
+		size_t count;
+	};
+
+	/*
+		Blocks of an expanded brick, either owned or borrowed from memory that
+		outlives the brick, like a mapped world file
+
+		Borrowed blocks that are read-only have to be copied with makeWritable
+		before they can be changed.
+	*/
+	class block_storage
+	{
+	public:
+		block_storage() : ptr(nullptr), count(0), readOnly(false) {}
+		block_storage(const block_storage& other) : owned(other.owned) { attach(other); }
+
+		block_storage& operator=(const block_storage& other)
+		{
+			owned = other.owned;
+			attach(other);
+			return *this;
+		}
+
+		bool empty() const { return count == 0; }
+		size_t size() const { return count; }
+
+		// Bytes of owned blocks, borrowed blocks don't count
+		size_t capacity() const { return owned.capacity(); }
+
+		bool isBorrowed() const { return count != 0 && owned.empty(); }
+
+		uint8_t& operator[](size_t i) { return ptr[i]; }
+		const uint8_t& operator[](size_t i) const { return ptr[i]; }
+
+		void assign(size_t n, uint8_t value) { owned.assign(n, value); attach(); }
+		void assign(const uint8_t* first, const uint8_t* last) { owned.assign(first, last); attach(); }
+
+		// Resize owned blocks, borrowed blocks are copied first
+		void resize(size_t n)
+		{
+			if (isBorrowed()) owned.assign(ptr, ptr + count);
+			owned.resize(n);
+			attach();
+		}
+
+		void release()
+		{
+			std::vector<uint8_t>().swap(owned);
+			ptr = nullptr;
+			count = 0;
+			readOnly = false;
+		}
+
+		void borrow(uint8_t* blocks, size_t n, bool writable)
+		{
+			release();
+			ptr = blocks;
+			count = n;
+			readOnly = !writable;
+		}
+
+		// Copy borrowed blocks that can't be written into owned memory
+		void makeWritable()
+		{
+			if (readOnly) resize(count);
+		}
+
+	private:
+		std::vector<uint8_t> owned;
+		uint8_t* ptr;
+		size_t count;
+		bool readOnly;
+
+		void attach()
+		{
+			ptr = owned.empty() ? nullptr : &owned[0];
+			count = owned.size();
+			readOnly = false;
+		}
+
+		void attach(const block_storage& other)
+		{
+			if (other.isBorrowed()) {
+				ptr = other.ptr;
+				count = other.count;
+				readOnly = other.readOnly;
+			} else {
+				attach();
+			}
+		}
+	};
+
+	/*
+		Brick of a world whose blocks live in memory outside of it
+	*/
+	struct mapped_brick
+	{
+		// Blocks in brick offset order, or nullptr if the brick is uniform
+		uint8_t* blocks;
+		material::material_t uniform;
+
+		// Bit per 4^3 node that contains a solid block
+		uint64_t occupancy;
+	};
+
+	/*
+		Axis aligned box of blocks, min is inclusive and max is exclusive
+	*/
+	struct box
+	{
+		glm::ivec3 min, max;
+
+		box() : min(0), max(0) {}
+		box(const glm::ivec3& min, const glm::ivec3& max) : min(min), max(max) {}
+
+		bool empty() const { return min.x >= max.x || min.y >= max.y || min.z >= max.z; }
+		long long volume() const { return empty() ? 0 : (long long)(max.x - min.x) * (max.y - min.y) * (max.z - min.z); }
+		bool contains(const box& b) const { return b.min.x >= min.x && b.min.y >= min.y && b.min.z >= min.z && b.max.x <= max.x && b.max.y <= max.y && b.max.z <= max.z; }
+
+		box merged(const box& b) const { return box(glm::min(min, b.min), glm::max(max, b.max)); }
+		box clipped(const box& b) const { return box(glm::max(min, b.min), glm::min(max, b.max)); }
+	};
+
+	// Add a region to a list, merging it with others as long as the union doesn't cover more than both separately.
+	// Once the list holds maxRegions, the region is merged with the one that grows the least instead.
+	void mergeRegion(std::vector<box>& regions, const box& region, size_t maxRegions = size_t(-1));
+
+	/*
+		Single block modification
+	*/
+	struct block_edit
+	{
+		int x, y, z;
+		material::material_t mat;
+	};
+
+	/*
+		Ray for bulk queries, distances are measured along the normalized direction
+	*/
+	struct ray
+	{
+		glm::vec3 origin, dir;
+		float maxDist;
+
+		ray() : origin(0.0f), dir(0.0f), maxDist(0.0f) {}
+		ray(const glm::vec3& origin, const glm::vec3& dir, float maxDist) : origin(origin), dir(dir), maxDist(maxDist) {}
+	};
+
+	/*
+		Result of casting a ray through the blocks of a world
+	*/
+	struct ray_hit
+	{
+		bool hit;
+
+		// Solid block that was hit and the normal of the face through which it was entered,
+		// which is zero if the ray started inside of it
+		glm::ivec3 block;
+		glm::ivec3 normal;
+
+		// Distance from the origin of the ray to the hit point
+		float distance;
+
+		material::material_t mat;
+	};
+
 	/*
 		Manager of the blocks in a world
+
+		Blocks are stored in bricks of BRICK_SIZE^3. A brick that contains only a
+		single material is stored as that material alone and is only expanded to
+		one byte per block when a different material is first written into it.
+		The order of the blocks inside an expanded brick is defined by Layout.
+
+		Edits also maintain an occupancy pyramid of nodes of 4^3, 16^3 and 64^3
+		blocks that tells ray traversal how much empty space it can skip at once.
+		Optionally they also repair a distance field with the Chebyshev distance
+		of every block to the nearest solid block, up to DISTANCE_LIMIT.
 	*/
-	class world
+	template <typename Layout>
+	class basic_world
 	{
 	public:
-		world(int sx, int sy, int sz);
+		/*
+			Groups edits so that their merged regions enter the change journal at once
+			when the outermost batch goes out of scope
+		*/
+		class batch
+		{
+		public:
+			batch(basic_world& w);
+			~batch();
+
+		private:
+			basic_world& w;
+
+			batch(const batch&);
+			batch& operator=(const batch&);
+		};
+
+		static const int JOURNAL_SIZE = 1024;
+
+		static const int BRICK_SHIFT = 4;
+		static const int BRICK_SIZE = 1 << BRICK_SHIFT;
+		static const int BRICK_VOLUME = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+		static const int OCCUPANCY_LEVELS = 3;
+		static const int DISTANCE_LIMIT = 32;
+
+		typedef Layout layout_type;
+
+		// Fills the BRICK_SIZE x BRICK_SIZE column of blocks with its lowest corner at x0, y0 over the full
+		// height of the brick grid, in x, y, z order
+		typedef std::function<void(int x0, int y0, uint8_t* blocks)> column_generator;
+
+		// Fills a brick with its blocks in brick offset order and returns true, or returns false and only sets
+		// uniform if all of them are the same material
+		typedef std::function<bool(int bx, int by, int bz, uint8_t* blocks, material::material_t& uniform)> brick_generator;
+
+		basic_world(int sx, int sy, int sz);
 
 		void createFlatWorld(int height, material::material_t mat = material::GRASS);
 
+		// Replace every block with generated columns on up to threads cores, or all of them if threads is 0.
+		// Columns are generated independently and in no particular order, so the generator has to be a
+		// function of the coordinates alone for the result to be the same on any number of threads.
+		void generate(const column_generator& gen, int threads = 0);
+
+		// Replace every brick with generated bricks on up to threads threads, or all of them if threads is 0
+		void generateBricks(const brick_generator& gen, int threads = 0);
+
+		// Use blocks kept alive by owner, like the pages of a mapped world file, as the storage of all bricks
+		// without reading them. Bricks of blocks that aren't writable are copied to memory of the world when
+		// they are first changed.
+		void mapBricks(const std::vector<mapped_brick>& mapped, const std::shared_ptr<void>& owner, bool writable);
+
 		int sizeX() const;
 		int sizeY() const;
 		int sizeZ() const;
 
-		void addBlockCallback(std::function<void (int x, int y, int z, material::material_t mat)> func);
+		// Number of changed regions recorded in the journal so far
+		uint64_t generation() const;
+
+		// Collect the merged regions changed after generation cursor and advance it, returns false
+		// if those changes have already left the journal and the whole world has to be re-read
+		bool pollChanges(uint64_t& cursor, std::vector<box>& regions) const;
 
 		void set(int x, int y, int z, material::material_t mat);
+		void setMany(const block_edit* edits, size_t count);
+		void setMany(const std::vector<block_edit>& edits);
+		void fill(const box& region, material::material_t mat);
 
 		material::material_t get(int x, int y, int z) const;
-		material::material_t get(int i) const;
+		material::material_t get(size_t i) const;
+
+		// Fast path without bounds checking, coordinates must lie inside the world
+		material::material_t getUnchecked(int x, int y, int z) const
+		{
+			const brick& b = bricks[toBrickIndex(x >> BRICK_SHIFT, y >> BRICK_SHIFT, z >> BRICK_SHIFT)];
+
+			if (b.blocks.empty())
+				return b.uniform;
+			else
+				return material::material_t(b.blocks[toBrickOffset(x & (BRICK_SIZE - 1), y & (BRICK_SIZE - 1), z & (BRICK_SIZE - 1))]);
+		}
+
+		size_t toFlatIndex(int x, int y, int z) const;
+
+		// Number of occupancy pyramid levels that are empty around the 4^3 node containing a block inside the world
+		int emptyLevels(int x, int y, int z) const
+		{
+			uint64_t occupancy = bricks[toBrickIndex(x >> BRICK_SHIFT, y >> BRICK_SHIFT, z >> BRICK_SHIFT)].occupancy;
+
+			if (occupancy & (uint64_t(1) << toNodeBit(x >> 2, y >> 2, z >> 2))) return 0;
+			if (occupancy != 0) return 1;
+
+			return occupiedRegions[toRegionIndex(x >> 6, y >> 6, z >> 6)] == 0 ? 3 : 2;
+		}
+
+		// Width of the largest empty node containing a block inside the world, 1 if only the block is empty and 0 if it's solid
+		int emptySpan(int x, int y, int z) const
+		{
+			const brick& b = bricks[toBrickIndex(x >> BRICK_SHIFT, y >> BRICK_SHIFT, z >> BRICK_SHIFT)];
+
+			// Solid node, so the block itself has to be checked
+			if (b.occupancy & (uint64_t(1) << toNodeBit(x >> 2, y >> 2, z >> 2))) {
+				if (b.blocks.empty())
+					return b.uniform == material::EMPTY ? 1 : 0;
+				else
+					return b.blocks[toBrickOffset(x & (BRICK_SIZE - 1), y & (BRICK_SIZE - 1), z & (BRICK_SIZE - 1))] == material::EMPTY ? 1 : 0;
+			}
 
-		int toFlatIndex(int x, int y, int z) const;
+			if (b.occupancy != 0) return 4;
+
+			return occupiedRegions[toRegionIndex(x >> 6, y >> 6, z >> 6)] == 0 ? 64 : 16;
+		}
+
+		// Find the first solid block along a ray, up to maxDist away from its origin
+		ray_hit raycast(const glm::vec3& origin, const glm::vec3& dir, float maxDist) const;
+
+		// Cast many rays at once, spread over the job pool. Hits are identical to raycast
+		void raycastMany(const ray* rays, ray_hit* hits, size_t count) const;
+		void raycastMany(const std::vector<ray>& rays, std::vector<ray_hit>& hits) const;
+
+		// Copy a region of blocks into a buffer in x, y, z order
+		void copyRegion(const box& region, uint8_t* out) const;
+
+		// Compute the distance field on all cores and keep it up to date with later edits
+		void buildDistanceField();
+		bool hasDistanceField() const;
+
+		// Chebyshev distance from a block inside the world to the nearest solid block, capped at DISTANCE_LIMIT,
+		// so all blocks less than that distance away are empty. Requires buildDistanceField.
+		int distanceToSolid(int x, int y, int z) const
+		{
+			return distances[(size_t(z) * sy + y) * sx + x];
+		}
+
+		// Copy a region of the distance field into a buffer in x, y, z order
+		void copyDistanceRegion(const box& region, uint8_t* out) const;
+
+		// Brick level access
+		int bricksX() const;
+		int bricksY() const;
+		int bricksZ() const;
+
+		bool isUniformBrick(int bx, int by, int bz) const;
+		material::material_t brickMaterial(int bx, int by, int bz) const;
+
+		// Bit per 4^3 node of a brick that contains a solid block
+		uint64_t brickOccupancy(int bx, int by, int bz) const;
+
+		// Blocks of an expanded brick in brick offset order, empty if the brick is uniform
+		block_span brickData(int bx, int by, int bz) const;
+
+		// Collapse expanded bricks that have become uniform again
+		void compact();
+
+		// Bytes used by block storage, blocks borrowed with mapBricks aren't counted
+		size_t memoryUsage() const;
 
 	private:
+		struct brick
+		{
+			material::material_t uniform;
+			block_storage blocks;
+
+			// Bit per 4^3 node that contains a solid block
+			uint64_t occupancy;
+		};
+
 		int sx, sy, sz;
-		std::vector<material::material_t> blocks;
-		std::vector<std::function<void (int x, int y, int z, material::material_t mat)>> callbacks;
+		int bsx, bsy, bsz;
+		std::vector<brick> bricks;
+
+		// Bit per brick of each 64^3 region that contains a solid block
+		int rsx, rsy, rsz;
+		std::vector<uint64_t> occupiedRegions;
+
+		// Distance per block in x, y, z order, empty until the field is built
+		std::vector<uint8_t> distances;
+
+		// Keeps the memory of borrowed blocks alive
+		std::shared_ptr<void> storageOwner;
+
+		std::vector<box> dirty;
+		int batchDepth;
+
+		std::vector<box> journal;
+		uint64_t journalGeneration;
+
+		int toBrickIndex(int bx, int by, int bz) const { return (bz * bsy + by) * bsx + bx; }
+		static int toBrickOffset(int x, int y, int z) { return Layout::offset(x, y, z); }
+
+		int toRegionIndex(int rx, int ry, int rz) const { return (rz * rsy + ry) * rsx + rx; }
+
+		// Bit of a child in the 4x4x4 children of its parent node
+		static int toNodeBit(int x, int y, int z) { return ((z & 3) << 4) | ((y & 3) << 2) | (x & 3); }
+
+		// Give a brick its own blocks that can be written, a uniform brick is expanded to its material
+		void expandBrick(brick& b);
+
+		// Replace all blocks of a brick with blocks in x, y, z order, only the bricks and region of the brick are touched
+		void storeBrick(int bx, int by, int bz, const uint8_t* blocks);
+		void setBlock(int x, int y, int z, material::material_t mat);
+
+		void updateOccupancy(int bx, int by, int bz);
+		void updateRegionOccupancy(int bx, int by, int bz);
+
+		void computeDistances(const box& region);
+
+		// Repair the distance field after the blocks of a small region changed, only visiting the blocks whose distance changes
+		void repairDistances(const box& region);
+
+		// Find the largest known box of empty blocks around a block inside the world, false if the block is solid
+		bool findEmptyBox(const glm::ivec3& coord, glm::ivec3& boxMin, glm::ivec3& boxMax) const;
+
+		void markDirty(const box& region);
+		void flushDirty();
 	};
+
+	typedef basic_world<layout::linear> world;
+	typedef basic_world<layout::morton> morton_world;
+	typedef basic_world<layout::tiled> tiled_world;
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,178 @@
+#ifndef RC_WORLD_FILE_HPP
+#define RC_WORLD_FILE_HPP
+
+#include <rc/world.hpp>
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rc
+{
+	/*
+		Versioned binary file with the blocks of a world
+
+		All numbers are little endian. The file starts with a header:
+
+			char[4]   magic "RCWF"
+			uint32    version
+			uint32    size of the header in bytes
+			int32[3]  size of the world in blocks
+			uint8     brick size and layout ID of the bricks
+			uint16    number of materials, followed by the name of each one as
+			          a uint8 length and that many characters
+
+		It is followed by an index with an entry per brick in x, y, z order:
+
+			uint64    offset of the data of the brick from the start of the file
+			uint32    size of the data
+			uint8     codec
+
+		Every brick is compressed on its own, so it can be read without the rest
+		of the file. Its blocks are stored in the order of the layout in the
+		header. A uniform brick is stored as its material alone, other bricks
+		are run-length encoded, LZ compressed or stored raw, whichever is the
+		smallest.
+
+		Files with another brick size, a layout other than linear, morton or
+		tiled, or more than 2^24 blocks along an axis are rejected, as are
+		files with more bricks than fit in an int.
+
+		Materials are matched by name when a file is read, so files stay valid
+		if the order of the materials changes. Materials with a name that isn't
+		known anymore are read as empty, and a brick with blocks of materials
+		that aren't in the header can't be read.
+
+		Files opened for writing can have single bricks replaced. A brick that
+		still fits is rewritten in place and other bricks are appended to the
+		end of the file, so no two bricks ever share their data.
+	*/
+	class world_file
+	{
+	public:
+		static const uint32_t VERSION = 1;
+
+		enum codec_t : uint8_t
+		{
+			UNIFORM,
+			RAW,
+			RLE,
+			LZ
+		};
+
+		world_file();
+		~world_file();
+
+		// Read the header and index of a file, false if it's missing or not a world file of a supported version
+		bool open(const std::string& path, bool writable = false);
+		void close();
+
+		// Write an empty world of the given size and layout without keeping its blocks in memory
+		static bool create(const std::string& path, int sx, int sy, int sz, int layoutId = layout::linear::ID);
+
+		// Offset of a block inside a brick with the layout of a file
+		static int blockOffset(int layoutId, int x, int y, int z);
+
+		bool isOpen() const;
+		bool isWritable() const { return writable; }
+
+		int sizeX() const { return sx; }
+		int sizeY() const { return sy; }
+		int sizeZ() const { return sz; }
+
+		int bricksX() const { return bsx; }
+		int bricksY() const { return bsy; }
+		int bricksZ() const { return bsz; }
+
+		int layoutId() const { return layout; }
+		const std::vector<std::string>& materialNames() const { return materials; }
+
+		// Read a brick into BRICK_VOLUME blocks in the order of the layout of the file, or only the first one
+		// with uniform set if the brick is a single material. Safe to call from multiple threads.
+		bool readBrick(int bx, int by, int bz, uint8_t* blocks, bool& uniform);
+
+		// Replace a brick with BRICK_VOLUME blocks in the order of the layout of the file, or with the first one
+		// if uniform is set. False if the file isn't writable or doesn't have one of the materials of the brick.
+		bool writeBrick(int bx, int by, int bz, const uint8_t* blocks, bool uniform);
+
+		// Read all bricks into a world of the same size, decoded on up to threads threads or all of them if 0
+		template <typename Layout>
+		bool readWorld(basic_world<Layout>& w, int threads = 0);
+
+	private:
+		struct index_entry
+		{
+			uint64_t offset;
+			uint32_t size;
+			codec_t codec;
+		};
+
+		FILE* file;
+		std::mutex fileMutex;
+		uint64_t fileSize;
+		uint64_t indexStart;
+		bool writable;
+
+		int sx, sy, sz;
+		int bsx, bsy, bsz;
+		int layout;
+		std::vector<std::string> materials;
+
+		// Current material for every material of the file, and the other way around with NO_MATERIAL
+		// for current materials that the file doesn't have
+		uint8_t materialMap[256];
+		uint16_t fileMaterials[256];
+		bool identityMap;
+
+		std::vector<index_entry> index;
+
+		world_file(const world_file&);
+		world_file& operator=(const world_file&);
+
+		bool decodeBrick(const index_entry& entry, const uint8_t* data, uint8_t* blocks, bool& uniform) const;
+	};
+
+	// Write a world to a file, encoding its bricks on up to threads threads or all of them if 0
+	template <typename Layout>
+	bool saveWorld(const basic_world<Layout>& w, const std::string& path, int threads = 0);
+
+	// Read a world written by saveWorld, nullptr if the file couldn't be read
+	template <typename Layout>
+	std::unique_ptr<basic_world<Layout>> loadWorld(const std::string& path, int threads = 0);
+
+	/*
+		Uncompressed world files that are mapped into memory instead of read
+
+		The header is the same as that of a compressed file, except that the magic
+		is "RCWM". It is followed by a table with an entry per brick in x, y, z order:
+
+			uint64    occupancy of the 4^3 nodes of the brick
+			uint32    slot of the blocks of the brick, or 0xffffffff if it's uniform
+			uint8     material of a uniform brick
+			uint8[3]  padding
+
+		The blocks start at the first multiple of 4096 bytes after the table, with
+		the BRICK_VOLUME blocks of every expanded brick in its slot in the order of
+		the layout in the header. A brick is a page of its own, so the bricks of a
+		mapped world are only read from disk when they're first used and processes
+		that map the same file share its pages.
+	*/
+
+	// Write a world to a file that can be mapped by a world of the same layout
+	template <typename Layout>
+	bool saveMappableWorld(const basic_world<Layout>& w, const std::string& path);
+
+	// Map a file written by saveMappableWorld as the blocks of a world, nullptr if it has a different layout or
+	// materials. Edits normally copy the changed bricks into memory. With copyOnWrite the file is mapped privately
+	// instead, so edits change the pages in place and the system copies them on the first write. Either way, the
+	// file itself is never changed. Mapped files are trusted input: only the header and brick table are checked,
+	// since checking the blocks would read every page. A corrupt brick shows materials that aren't in the header,
+	// which the material lookups wrap around, and a wrong occupancy mask makes rays skip solid blocks. Files that
+	// may be corrupt should be read with loadWorld instead.
+	template <typename Layout>
+	std::unique_ptr<basic_world<Layout>> mapWorld(const std::string& path, bool copyOnWrite = false);
+}
+
+#endif
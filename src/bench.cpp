@@ -0,0 +1,858 @@
+// Raycraft internals
+#include <rc/world.hpp>
+#include <rc/voxel_ray.hpp>
+#include <rc/terrain.hpp>
+#include <rc/jobs.hpp>
+#include <rc/world_file.hpp>
+#include <rc/streamed_world.hpp>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+	Headless micro benchmarks of the building blocks of the ray tracer
+*/
+
+// Configuration
+const int RAY_COUNT = 200000;
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+static double elapsedMs(bench_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+/*
+	Original block stepping of renderer.frag, kept as a baseline
+*/
+namespace legacy
+{
+	static const float INF = std::numeric_limits<float>::infinity();
+
+	glm::ivec3 toBlock(glm::vec3 pos, glm::vec3 dir)
+	{
+		if ((dir.x < 0.0f && pos.x < 0.001f) || (dir.y < 0.0f && pos.y < 0.001f) || (dir.z < 0.0f && pos.z < 0.001f))
+			return glm::ivec3(-1, -1, -1);
+		else
+			return glm::ivec3(int(pos.x), int(pos.y), int(pos.z));
+	}
+
+	glm::vec3 rayPlaneIntersect(glm::vec3 linePos, glm::vec3 lineDir, glm::vec3 planePos, glm::vec3 planeNormal)
+	{
+		float d = glm::dot(planePos - linePos, planeNormal) / glm::dot(lineDir, planeNormal);
+		return d > 0.0f ? linePos + d * lineDir : glm::vec3(INF);
+	}
+
+	bool rayCube(glm::vec3 origin, glm::vec3 dir, glm::vec3 pos, glm::vec3 size, glm::vec3& hitPos, glm::vec3& hitNormal)
+	{
+		origin -= pos;
+
+		float dist = INF;
+		glm::vec3 final, norm;
+
+		// Faces in the same order as the shader
+		const glm::vec3 planes[6] = { glm::vec3(0), glm::vec3(0, 0, size.z), glm::vec3(0), glm::vec3(size.x, 0, 0), glm::vec3(0), glm::vec3(0, size.y, 0) };
+		const glm::vec3 normals[6] = { glm::vec3(0, 0, 1), glm::vec3(0, 0, 1), glm::vec3(-1, 0, 0), glm::vec3(1, 0, 0), glm::vec3(0, -1, 0), glm::vec3(0, 1, 0) };
+		const glm::vec3 faces[6] = { glm::vec3(0, 0, -1), glm::vec3(0, 0, 1), glm::vec3(-1, 0, 0), glm::vec3(1, 0, 0), glm::vec3(0, -1, 0), glm::vec3(0, 1, 0) };
+
+		for (int i = 0; i < 6; i++) {
+			glm::vec3 temp = rayPlaneIntersect(origin, dir, planes[i], normals[i]);
+
+			// Components that lie within the face, the remaining one lies on its plane
+			int a = i < 2 ? 0 : (i < 4 ? 1 : 0);
+			int b = i < 2 ? 1 : 2;
+
+			if (temp[a] > 0.0f && temp[a] < size[a] && temp[b] > 0.0f && temp[b] < size[b] && glm::distance(origin, temp) < dist) {
+				dist = glm::distance(origin, temp);
+				final = temp;
+				norm = faces[i];
+			}
+		}
+
+		hitPos = pos + final;
+		hitNormal = norm;
+
+		return dist != INF;
+	}
+
+	// Returns the number of steps taken until a solid block or the end of the world is reached
+	int trace(const rc::world& w, glm::vec3 rayStart, glm::vec3 rayDir, glm::ivec3& hitBlock)
+	{
+		glm::vec3 size(w.sizeX(), w.sizeY(), w.sizeZ());
+		bool inside = rayStart.x >= 0.0f && rayStart.y >= 0.0f && rayStart.z >= 0.0f && rayStart.x <= size.x && rayStart.y <= size.y && rayStart.z <= size.z;
+
+		glm::ivec3 coord(0);
+		glm::vec3 rayPos, hitP, hitN;
+
+		if (inside) {
+			coord = toBlock(rayStart, rayDir);
+			rayCube(rayStart, rayDir, glm::vec3(coord), glm::vec3(1), hitP, hitN);
+		} else if (!rayCube(rayStart, rayDir, glm::vec3(0), size, hitP, hitN)) {
+			return 0;
+		}
+
+		int maxIterations = w.sizeX() + w.sizeY() + w.sizeZ();
+		int iterations = 0;
+
+		while (iterations < maxIterations && coord.x > -1 && coord.y > -1 && coord.z > -1 && coord.x < w.sizeX() + 1 && coord.y < w.sizeY() + 1 && coord.z < w.sizeZ() + 1) {
+			if (iterations > 0)
+				rayCube(rayPos, rayDir, glm::vec3(coord), glm::vec3(1), hitP, hitN);
+
+			rayPos = hitP + rayDir * 0.0001f;
+			coord = toBlock(rayPos, rayDir);
+
+			iterations++;
+
+			if (w.get(coord.x, coord.y, coord.z) != rc::material::EMPTY) {
+				hitBlock = coord;
+				break;
+			}
+		}
+
+		return iterations;
+	}
+}
+
+// Returns the number of steps taken until a solid block or the end of the world is reached
+static int traceVoxelRay(const rc::world& w, glm::vec3 rayStart, glm::vec3 rayDir, glm::ivec3& hitBlock)
+{
+	rc::voxel_ray ray(rayStart, rayDir, glm::ivec3(w.sizeX(), w.sizeY(), w.sizeZ()));
+	if (!ray.hitsGrid()) return 0;
+
+	if (ray.startedInside())
+		ray.step();
+
+	int maxIterations = w.sizeX() + w.sizeY() + w.sizeZ();
+	int iterations = 0;
+
+	while (iterations < maxIterations && ray.inside()) {
+		glm::ivec3 coord = ray.block();
+		iterations++;
+
+		if (w.getUnchecked(coord.x, coord.y, coord.z) != rc::material::EMPTY) {
+			hitBlock = coord;
+			break;
+		}
+
+		ray.step();
+	}
+
+	return iterations;
+}
+
+// Same as traceVoxelRay, but jumps over empty nodes of the occupancy pyramid and optionally the distance field
+static int traceSkipping(const rc::world& w, glm::vec3 rayStart, glm::vec3 rayDir, glm::ivec3& hitBlock, bool useDistanceField = false)
+{
+	rc::voxel_ray ray(rayStart, rayDir, glm::ivec3(w.sizeX(), w.sizeY(), w.sizeZ()));
+	if (!ray.hitsGrid()) return 0;
+
+	if (ray.startedInside())
+		ray.step();
+
+	int maxIterations = w.sizeX() + w.sizeY() + w.sizeZ();
+	int iterations = 0;
+
+	while (iterations < maxIterations && ray.inside()) {
+		glm::ivec3 coord = ray.block();
+		int dist = useDistanceField ? w.distanceToSolid(coord.x, coord.y, coord.z) : 0;
+		iterations++;
+
+		if (dist > 1) {
+			ray.skip(coord - (dist - 1), coord + dist);
+			continue;
+		}
+
+		int span = w.emptySpan(coord.x, coord.y, coord.z);
+
+		if (span > 1) {
+			glm::ivec3 nodeMin(coord.x & ~(span - 1), coord.y & ~(span - 1), coord.z & ~(span - 1));
+			ray.skip(nodeMin, nodeMin + span);
+			continue;
+		}
+
+		if (span == 0) {
+			hitBlock = coord;
+			break;
+		}
+
+		ray.step();
+	}
+
+	return iterations;
+}
+
+// Rays from random points above a world towards random points on its ground
+static void makeRays(const rc::world& w, std::vector<glm::vec3>& origins, std::vector<glm::vec3>& dirs)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> ux(0.0f, float(w.sizeX()));
+	std::uniform_real_distribution<float> uy(0.0f, float(w.sizeY()));
+
+	origins.resize(RAY_COUNT);
+	dirs.resize(RAY_COUNT);
+
+	for (int i = 0; i < RAY_COUNT; i++) {
+		origins[i] = glm::vec3(ux(rng), uy(rng), w.sizeZ() * 1.5f);
+		dirs[i] = glm::normalize(glm::vec3(ux(rng), uy(rng), 0.0f) - origins[i]);
+	}
+}
+
+static void benchTraversal()
+{
+	printf("traversal: cost per step of the original plane stepping and the 3D-DDA\n");
+	printf("%8s %12s %12s %12s %12s %10s\n", "world", "method", "steps/ray", "ns/step", "Mrays/s", "mismatch");
+
+	const int sizes[] = { 64, 256, 512 };
+
+	for (int s = 0; s < 3; s++) {
+		int size = sizes[s];
+
+		// Flat ground with scattered pillars, so that rays cross a varying amount of air
+		rc::world w(size, size, size / 2);
+		w.createFlatWorld(size / 8);
+
+		std::mt19937 rng(size);
+		for (int i = 0; i < size * size / 64; i++) {
+			int x = rng() % size, y = rng() % size;
+			w.fill(rc::box(glm::ivec3(x, y, 0), glm::ivec3(x + 1, y + 1, size / 8 + rng() % (size / 4))), rc::material::STONE);
+		}
+
+		std::vector<glm::vec3> origins, dirs;
+		makeRays(w, origins, dirs);
+
+		std::vector<glm::ivec3> legacyHits(RAY_COUNT, glm::ivec3(-1)), ddaHits(RAY_COUNT, glm::ivec3(-1));
+
+		for (int method = 0; method < 2; method++) {
+			long long steps = 0;
+			bench_clock::time_point start = bench_clock::now();
+
+			for (int i = 0; i < RAY_COUNT; i++) {
+				if (method == 0)
+					steps += legacy::trace(w, origins[i], dirs[i], legacyHits[i]);
+				else
+					steps += traceVoxelRay(w, origins[i], dirs[i], ddaHits[i]);
+			}
+
+			double ms = elapsedMs(start);
+
+			int mismatches = 0;
+			if (method == 1) {
+				for (int i = 0; i < RAY_COUNT; i++)
+					if (legacyHits[i] != ddaHits[i]) mismatches++;
+			}
+
+			char world[32];
+			sprintf(world, "%d^2", size);
+
+			printf("%8s %12s %12.1f %12.2f %12.2f %10d\n", world, method == 0 ? "planes" : "dda", double(steps) / RAY_COUNT, ms * 1e6 / steps, RAY_COUNT / ms / 1000.0, mismatches);
+		}
+	}
+}
+
+// Rolling hills with scattered stone pillars
+static void makeTerrain(rc::world& w)
+{
+	rc::world::batch b(w);
+	std::mt19937 rng(w.sizeX());
+
+	for (int y = 0; y < w.sizeY(); y++) {
+		for (int x = 0; x < w.sizeX(); x++) {
+			float h = w.sizeZ() * (0.25f + 0.1f * std::sin(x * 0.043f) * std::cos(y * 0.037f) + 0.05f * std::sin((x + y) * 0.11f));
+			w.fill(rc::box(glm::ivec3(x, y, 0), glm::ivec3(x + 1, y + 1, int(h))), rc::material::GRASS);
+
+			if (rng() % 512 == 0)
+				w.fill(rc::box(glm::ivec3(x, y, int(h)), glm::ivec3(x + 1, y + 1, int(h) + 4 + rng() % 12)), rc::material::STONE);
+		}
+	}
+}
+
+// Primary rays of a frame seen from a corner of a world above its surface
+static void makeFrameRays(const rc::world& w, int width, int height, std::vector<glm::vec3>& origins, std::vector<glm::vec3>& dirs)
+{
+	glm::vec3 pos(w.sizeX() * 0.05f, w.sizeY() * 0.05f, w.sizeZ() * 0.8f);
+	glm::vec3 target(w.sizeX() * 0.5f, w.sizeY() * 0.5f, w.sizeZ() * 0.2f);
+	glm::mat4 invProjView = glm::inverse(glm::perspective(70.0f, float(width) / height, 1.0f, 1000.0f) * glm::lookAt(pos, target, glm::vec3(0.0f, 0.0f, 1.0f)));
+
+	origins.assign(width * height, pos);
+	dirs.resize(width * height);
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			glm::vec4 v = invProjView * glm::vec4((x + 0.5f) / width * 2.0f - 1.0f, (y + 0.5f) / height * 2.0f - 1.0f, 1.0f, 1.0f);
+			dirs[y * width + x] = glm::normalize(glm::vec3(v));
+		}
+	}
+}
+
+static void benchDistance()
+{
+	printf("distance: primary rays of a 640x360 frame over terrain with and without the distance field\n");
+	printf("%8s %10s %12s %12s %10s\n", "world", "method", "steps/ray", "ms/frame", "mismatch");
+
+	const int sizes[] = { 128, 256, 512 };
+	const char* methods[] = { "dda", "occupancy", "distance" };
+
+	for (int s = 0; s < 3; s++) {
+		int size = sizes[s];
+
+		rc::world w(size, size, 128);
+		makeTerrain(w);
+
+		bench_clock::time_point start = bench_clock::now();
+		w.buildDistanceField();
+		double buildMs = elapsedMs(start);
+
+		std::vector<glm::vec3> origins, dirs;
+		makeFrameRays(w, 640, 360, origins, dirs);
+		int count = int(origins.size());
+
+		std::vector<glm::ivec3> hits[3];
+
+		char world[32];
+		sprintf(world, "%d^2", size);
+
+		for (int method = 0; method < 3; method++) {
+			hits[method].assign(count, glm::ivec3(-1));
+
+			long long steps = 0;
+			start = bench_clock::now();
+
+			for (int i = 0; i < count; i++) {
+				if (method == 0)
+					steps += traceVoxelRay(w, origins[i], dirs[i], hits[method][i]);
+				else
+					steps += traceSkipping(w, origins[i], dirs[i], hits[method][i], method == 2);
+			}
+
+			double ms = elapsedMs(start);
+
+			int mismatches = 0;
+			for (int i = 0; i < count; i++)
+				if (hits[0][i] != hits[method][i]) mismatches++;
+
+			printf("%8s %10s %12.1f %12.2f %10d\n", world, methods[method], double(steps) / count, ms, mismatches);
+		}
+
+		// Single block edits repair the field around them, half of them remove a block at the surface
+		std::mt19937 rng(size);
+		start = bench_clock::now();
+
+		for (int i = 0; i < 16; i++) {
+			int x = rng() % size, y = rng() % size;
+
+			if (i % 2 == 0) {
+				w.set(x, y, rng() % 128, rc::material::STONE);
+			} else {
+				int z = 127;
+				while (z > 0 && w.get(x, y, z) == rc::material::EMPTY) z--;
+				w.set(x, y, z, rc::material::EMPTY);
+			}
+		}
+
+		double repairMs = elapsedMs(start) / 16;
+
+		// The repaired field has to be the same as one built from scratch
+		rc::world rebuilt(w);
+		rebuilt.buildDistanceField();
+
+		int mismatches = 0;
+		for (int z = 0; z < w.sizeZ(); z++)
+			for (int y = 0; y < w.sizeY(); y++)
+				for (int x = 0; x < w.sizeX(); x++)
+					if (w.distanceToSolid(x, y, z) != rebuilt.distanceToSolid(x, y, z)) mismatches++;
+
+		printf("%8s   build %.1f ms, repair after single edit %.3f ms, %d distances differ from a rebuild\n", world, buildMs, repairMs, mismatches);
+	}
+}
+
+// Batches have to find exactly the same hit as single rays, down to the distance
+static bool sameHit(const rc::ray_hit& a, const rc::ray_hit& b)
+{
+	if (a.hit != b.hit) return false;
+	return !a.hit || (a.block == b.block && a.normal == b.normal && a.distance == b.distance && a.mat == b.mat);
+}
+
+static void benchRaycast()
+{
+	printf("raycast: world::raycast per ray against world::raycastMany on the job pool (job threads: %d)\n", rc::jobs::shared().threadCount());
+	printf("%8s %10s %10s %12s %12s %10s\n", "world", "rays", "method", "ms", "Mrays/s", "mismatch");
+
+	const int sizes[] = { 128, 512 };
+
+	for (int s = 0; s < 2; s++) {
+		int size = sizes[s];
+
+		rc::world w(size, size, 128);
+		makeTerrain(w);
+
+		// Camera rays of a frame are coherent, line of sight tests between random points aren't
+		std::vector<rc::ray> sets[2];
+		const char* setNames[] = { "frame", "sight" };
+
+		std::vector<glm::vec3> origins, dirs;
+		makeFrameRays(w, 640, 360, origins, dirs);
+
+		for (int i = 0; i < origins.size(); i++)
+			sets[0].push_back(rc::ray(origins[i], dirs[i], std::numeric_limits<float>::infinity()));
+
+		std::mt19937 rng(size);
+		std::uniform_real_distribution<float> ux(0.0f, float(size)), uz(0.0f, 128.0f);
+
+		for (int i = 0; i < RAY_COUNT; i++) {
+			glm::vec3 from(ux(rng), ux(rng), uz(rng)), to(ux(rng), ux(rng), uz(rng));
+			sets[1].push_back(rc::ray(from, to - from, glm::distance(from, to)));
+		}
+
+		for (int set = 0; set < 2; set++) {
+			const std::vector<rc::ray>& rays = sets[set];
+			std::vector<rc::ray_hit> single(rays.size()), many;
+
+			bench_clock::time_point start = bench_clock::now();
+
+			for (int i = 0; i < rays.size(); i++)
+				single[i] = w.raycast(rays[i].origin, rays[i].dir, rays[i].maxDist);
+
+			double singleMs = elapsedMs(start);
+
+			start = bench_clock::now();
+			w.raycastMany(rays, many);
+			double manyMs = elapsedMs(start);
+
+			int mismatches = 0;
+			for (int i = 0; i < rays.size(); i++)
+				if (!sameHit(single[i], many[i])) mismatches++;
+
+			char world[32];
+			sprintf(world, "%d^2", size);
+
+			printf("%8s %10s %10s %12.1f %12.2f %10s\n", world, setNames[set], "single", singleMs, rays.size() / singleMs / 1000.0, "");
+			printf("%8s %10s %10s %12.1f %12.2f %10d\n", world, setNames[set], "batch", manyMs, rays.size() / manyMs / 1000.0, mismatches);
+		}
+	}
+}
+
+static void benchOccupancy()
+{
+	printf("occupancy: plain 3D-DDA against skipping empty nodes of the occupancy pyramid\n");
+	printf("%8s %8s %12s %12s %12s %10s\n", "world", "method", "steps/ray", "ms", "Mrays/s", "mismatch");
+
+	const int sizes[] = { 256, 512, 1024 };
+
+	for (int s = 0; s < 3; s++) {
+		int size = sizes[s];
+
+		// Thin ground with a few tall towers, mostly air like a typical outdoor scene
+		rc::world w(size, size, 128);
+		w.createFlatWorld(4);
+
+		std::mt19937 rng(size);
+		for (int i = 0; i < size * size / 4096; i++) {
+			int x = rng() % (size - 8), y = rng() % (size - 8);
+			w.fill(rc::box(glm::ivec3(x, y, 0), glm::ivec3(x + 8, y + 8, 16 + rng() % 96)), rc::material::STONE);
+		}
+
+		std::vector<glm::vec3> origins, dirs;
+		makeRays(w, origins, dirs);
+
+		std::vector<glm::ivec3> plainHits(RAY_COUNT, glm::ivec3(-1)), skipHits(RAY_COUNT, glm::ivec3(-1));
+
+		for (int method = 0; method < 2; method++) {
+			long long steps = 0;
+			bench_clock::time_point start = bench_clock::now();
+
+			for (int i = 0; i < RAY_COUNT; i++) {
+				if (method == 0)
+					steps += traceVoxelRay(w, origins[i], dirs[i], plainHits[i]);
+				else
+					steps += traceSkipping(w, origins[i], dirs[i], skipHits[i]);
+			}
+
+			double ms = elapsedMs(start);
+
+			int mismatches = 0;
+			if (method == 1) {
+				for (int i = 0; i < RAY_COUNT; i++)
+					if (plainHits[i] != skipHits[i]) mismatches++;
+			}
+
+			char world[32];
+			sprintf(world, "%d^2", size);
+
+			printf("%8s %8s %12.1f %12.1f %12.2f %10d\n", world, method == 0 ? "dda" : "skip", double(steps) / RAY_COUNT, ms, RAY_COUNT / ms / 1000.0, mismatches);
+		}
+	}
+}
+
+// FNV-1a digest of every brick, to compare worlds without copying out all of their blocks
+static uint64_t worldDigest(const rc::world& w)
+{
+	uint64_t h = 14695981039346656037ull;
+
+	for (int bz = 0; bz < w.bricksZ(); bz++) {
+		for (int by = 0; by < w.bricksY(); by++) {
+			for (int bx = 0; bx < w.bricksX(); bx++) {
+				rc::block_span blocks = w.brickData(bx, by, bz);
+
+				if (blocks.empty()) {
+					h = (h ^ w.brickMaterial(bx, by, bz)) * 1099511628211ull;
+				} else {
+					for (size_t i = 0; i < blocks.size(); i++)
+						h = (h ^ blocks[i]) * 1099511628211ull;
+				}
+			}
+		}
+	}
+
+	return h;
+}
+
+static void benchTerrain()
+{
+	printf("terrain: generating seeded terrain on one thread against all cores\n");
+	printf("%12s %8s %12s %12s %12s %10s\n", "world", "threads", "ms", "Mblocks/s", "MB", "mismatch");
+
+	const int sizes[] = { 256, 512, 1024 };
+	int cores = std::max(1, int(std::thread::hardware_concurrency()));
+
+	for (int s = 0; s < 3; s++) {
+		int size = sizes[s];
+		uint64_t reference = 0;
+
+		for (int run = 0; run < 2; run++) {
+			int threads = run == 0 ? 1 : cores;
+
+			rc::world w(size, size, 256);
+			rc::terrain_generator gen(1);
+			gen.setThreadCount(threads);
+
+			bench_clock::time_point start = bench_clock::now();
+			gen.generate(w);
+			double ms = elapsedMs(start);
+
+			// The same seed has to result in the same world on any number of threads
+			uint64_t digest = worldDigest(w);
+			if (run == 0) reference = digest;
+
+			char world[32];
+			sprintf(world, "%d^2x256", size);
+
+			printf("%12s %8d %12.1f %12.1f %12.1f %10s\n", world, threads, ms, double(size) * size * 256 / ms / 1000.0, w.memoryUsage() / 1048576.0, run == 0 ? "" : (digest == reference ? "0" : "1"));
+		}
+	}
+}
+
+// Integer mixing as a stand-in for a unit of work that doesn't touch memory
+static uint32_t mixWork(uint32_t h, int iterations)
+{
+	for (int i = 0; i < iterations; i++) {
+		h ^= h >> 16;
+		h *= 0x7feb352du;
+		h ^= h >> 15;
+	}
+
+	return h;
+}
+
+static void benchJobs()
+{
+	printf("jobs: scaling of the job pool from one thread to all cores\n");
+	printf("%10s %8s %12s %10s %10s\n", "workload", "threads", "ms", "speedup", "mismatch");
+
+	int cores = std::max(1, int(std::thread::hardware_concurrency()));
+
+	std::vector<int> threadCounts;
+	for (int t = 1; t < cores; t *= 2) threadCounts.push_back(t);
+	threadCounts.push_back(cores);
+
+	const char* workloads[] = { "for", "graph", "terrain" };
+
+	for (int workload = 0; workload < 3; workload++) {
+		double baseMs = 0.0;
+		uint64_t reference = 0;
+
+		for (int i = 0; i < threadCounts.size(); i++) {
+			int threads = threadCounts[i];
+			rc::jobs::pool pool(threads);
+			uint64_t result = 0;
+
+			bench_clock::time_point start = bench_clock::now();
+
+			if (workload == 0) {
+				// Flat loop over a 3D range, split by the chunk hint
+				std::atomic<uint64_t> sum(0);
+
+				pool.parallelFor(rc::box(glm::ivec3(0, 0, 0), glm::ivec3(256, 256, 64)), glm::ivec3(64, 64, 16), [&] (const rc::box& b) {
+					uint64_t local = 0;
+
+					for (int z = b.min.z; z < b.max.z; z++)
+						for (int y = b.min.y; y < b.max.y; y++)
+							for (int x = b.min.x; x < b.max.x; x++)
+								local += mixWork((z << 16) | (y << 8) | x, 16);
+
+					sum += local;
+				});
+
+				result = sum;
+			} else if (workload == 1) {
+				// Levels of tasks that each depend on two tasks of the level before
+				const int LEVELS = 32, WIDTH = 64;
+				std::vector<uint32_t> values(LEVELS * WIDTH);
+				std::vector<rc::jobs::task> previous, current;
+
+				for (int level = 0; level < LEVELS; level++) {
+					current.clear();
+
+					for (int j = 0; j < WIDTH; j++) {
+						std::vector<rc::jobs::task> deps;
+						if (level > 0) {
+							deps.push_back(previous[j]);
+							deps.push_back(previous[(j + 1) % WIDTH]);
+						}
+
+						uint32_t* v = &values[0];
+						current.push_back(pool.submit([v, level, j] () {
+							uint32_t seed = level == 0 ? uint32_t(j) : v[(level - 1) * WIDTH + j] + v[(level - 1) * WIDTH + (j + 1) % WIDTH];
+							v[level * WIDTH + j] = mixWork(seed, 20000);
+						}, deps));
+					}
+
+					previous.swap(current);
+				}
+
+				pool.wait(previous);
+
+				for (int j = 0; j < WIDTH; j++)
+					result = result * 31 + values[(LEVELS - 1) * WIDTH + j];
+			} else {
+				// Terrain generation, which runs on the shared pool
+				rc::world w(512, 512, 256);
+				rc::terrain_generator gen(1);
+				gen.setThreadCount(threads);
+				gen.generate(w);
+
+				result = worldDigest(w);
+			}
+
+			double ms = elapsedMs(start);
+
+			if (i == 0) {
+				baseMs = ms;
+				reference = result;
+			}
+
+			printf("%10s %8d %12.1f %10.2f %10d\n", workloads[workload], threads, ms, baseMs / ms, result == reference ? 0 : 1);
+		}
+	}
+}
+
+static void benchWorldFile()
+{
+	printf("file: saving and loading terrain as a compressed world file\n");
+	printf("%14s %10s %10s %10s %10s %10s %10s\n", "world", "save ms", "load ms", "raw MB/s", "file MB", "ratio", "mismatch");
+
+	const glm::ivec3 sizes[] = { glm::ivec3(512, 512, 256), glm::ivec3(1024, 1024, 256), glm::ivec3(1024, 1024, 1024) };
+	const char* path = "raycraft-bench.rcw";
+
+	for (int s = 0; s < 3; s++) {
+		glm::ivec3 size = sizes[s];
+		double rawMb = double(size.x) * size.y * size.z / 1048576.0;
+
+		rc::world w(size.x, size.y, size.z);
+		rc::terrain_generator(1).generate(w);
+
+		bench_clock::time_point start = bench_clock::now();
+		bool saved = rc::saveWorld(w, path);
+		double saveMs = elapsedMs(start);
+
+		start = bench_clock::now();
+		std::unique_ptr<rc::world> loaded = rc::loadWorld<rc::layout::linear>(path);
+		double loadMs = elapsedMs(start);
+
+		FILE* f = fopen(path, "rb");
+		fseek(f, 0, SEEK_END);
+		double fileMb = ftell(f) / 1048576.0;
+		fclose(f);
+		remove(path);
+
+		char world[32];
+		sprintf(world, "%dx%dx%d", size.x, size.y, size.z);
+
+		bool same = saved && loaded && worldDigest(*loaded) == worldDigest(w);
+		printf("%14s %10.1f %10.1f %10.0f %10.1f %9.1f%% %10d\n", world, saveMs, loadMs, rawMb / (std::max(saveMs, loadMs) / 1000.0), fileMb, 100.0 * fileMb / rawMb, same ? 0 : 1);
+	}
+}
+
+static void benchMappedWorld()
+{
+	printf("map: mapping an uncompressed world file compared to loading a compressed one\n");
+	printf("%14s %10s %10s %10s %10s %10s %10s %10s\n", "world", "load ms", "map ms", "touch ms", "loaded MB", "mapped MB", "file MB", "mismatch");
+
+	const glm::ivec3 sizes[] = { glm::ivec3(512, 512, 256), glm::ivec3(1024, 1024, 256) };
+	const char* path = "raycraft-bench.rcw";
+	const char* mappedPath = "raycraft-bench.rcwm";
+
+	for (int s = 0; s < 2; s++) {
+		glm::ivec3 size = sizes[s];
+
+		rc::world w(size.x, size.y, size.z);
+		rc::terrain_generator(1).generate(w);
+
+		bool saved = rc::saveWorld(w, path) && rc::saveMappableWorld(w, mappedPath);
+
+		bench_clock::time_point start = bench_clock::now();
+		std::unique_ptr<rc::world> loaded = rc::loadWorld<rc::layout::linear>(path);
+		double loadMs = elapsedMs(start);
+
+		start = bench_clock::now();
+		std::unique_ptr<rc::world> mapped = rc::mapWorld<rc::layout::linear>(mappedPath);
+		double mapMs = elapsedMs(start);
+
+		// Reading every block faults in all pages, from the page cache since the file was just written
+		uint64_t reference = worldDigest(w);
+
+		start = bench_clock::now();
+		bool same = saved && loaded && mapped && worldDigest(*mapped) == reference;
+		double touchMs = elapsedMs(start);
+
+		FILE* f = fopen(mappedPath, "rb");
+		fseek(f, 0, SEEK_END);
+		double fileMb = ftell(f) / 1048576.0;
+		fclose(f);
+
+		double loadedMb = loaded ? loaded->memoryUsage() / 1048576.0 : 0.0;
+		double mappedMb = mapped ? mapped->memoryUsage() / 1048576.0 : 0.0;
+
+		mapped.reset();
+		remove(path);
+		remove(mappedPath);
+
+		char world[32];
+		sprintf(world, "%dx%dx%d", size.x, size.y, size.z);
+
+		printf("%14s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10d\n", world, loadMs, mapMs, touchMs, loadedMb, mappedMb, fileMb, same ? 0 : 1);
+	}
+}
+
+static void benchStreamedWorld()
+{
+	printf("stream: random and coherent access to a terrain file through a cache of 1024 bricks, job threads: %d\n", rc::jobs::shared().threadCount());
+	printf("%12s %10s %10s %10s %8s %10s %10s %10s %10s %10s %10s %10s\n", "pattern", "accesses", "ms", "M/s", "hit %", "misses", "waits", "evictions", "writes", "prefetched", "cancelled", "mismatch");
+
+	const int ACCESSES = 2000000;
+	const int CAPACITY = 1024;
+	const char* path = "raycraft-bench.rcw";
+
+	rc::world w(1024, 1024, 256);
+	rc::terrain_generator(1).generate(w);
+	rc::saveWorld(w, path);
+
+	rc::world_file file;
+	file.open(path, true);
+
+	const char* patterns[] = { "random", "walk", "flight", "flight+pf", "random set" };
+
+	for (int p = 0; p < 5; p++) {
+		rc::streamed_world s(file, CAPACITY);
+		std::mt19937 rng(p);
+
+		// Every write re-encodes a brick, so there are fewer of them
+		int accesses = p == 4 ? ACCESSES / 10 : ACCESSES;
+
+		// Uniform positions, a random walk, or reads within 24 blocks of a camera flying diagonally over the terrain
+		std::vector<glm::ivec3> coords(accesses);
+		glm::ivec3 pos(512, 512, 128);
+
+		for (int i = 0; i < accesses; i++) {
+			if (p == 0 || p == 4) {
+				coords[i] = glm::ivec3(rng() % w.sizeX(), rng() % w.sizeY(), rng() % w.sizeZ());
+			} else if (p == 1) {
+				pos += glm::ivec3(rng() % 5, rng() % 5, rng() % 5) - 2;
+				pos = glm::clamp(pos, glm::ivec3(0), glm::ivec3(w.sizeX(), w.sizeY(), w.sizeZ()) - 1);
+				coords[i] = pos;
+			} else {
+				int t = (i / 16) % 1024;
+				glm::ivec3 offset;
+
+				do {
+					offset = glm::ivec3(rng() % 49, rng() % 49, rng() % 49) - 24;
+				} while (glm::dot(glm::vec3(offset), glm::vec3(offset)) > 24.0f * 24.0f);
+
+				coords[i] = glm::clamp(glm::ivec3(t, t, 128) + offset, glm::ivec3(0), glm::ivec3(w.sizeX(), w.sizeY(), w.sizeZ()) - 1);
+			}
+		}
+
+		int mismatches = 0;
+		bench_clock::time_point start = bench_clock::now();
+
+		for (int i = 0; i < accesses; i++) {
+			const glm::ivec3& c = coords[i];
+
+			// Read ahead around where the camera will be after another 8 steps, the bricks behind it are in memory
+			if (p == 3 && i % 128 == 0) {
+				int t = (i / 16 + 8) % 1024;
+				s.prefetch(glm::vec3(t, t, 128), 28.0f);
+			}
+
+			if (p == 4)
+				s.set(c.x, c.y, c.z, rc::material::GOLD);
+			else if (s.get(c.x, c.y, c.z) != w.get(c.x, c.y, c.z))
+				mismatches++;
+		}
+
+		double ms = elapsedMs(start);
+		const rc::streamed_world::counters& n = s.stats();
+
+		printf("%12s %10d %10.1f %10.2f %7.1f%% %10llu %10llu %10llu %10llu %10llu %10llu %10d\n", patterns[p], accesses, ms, accesses / ms / 1000.0, 100.0 * n.hits / accesses,
+			(unsigned long long) n.misses, (unsigned long long) n.waits, (unsigned long long) n.evictions, (unsigned long long) n.writes,
+			(unsigned long long) n.prefetched, (unsigned long long) n.cancelled, mismatches);
+	}
+
+	file.close();
+	remove(path);
+}
+
+int main(int argc, char* argv[])
+{
+	struct { const char* name; void (*func)(); } benchmarks[] = {
+		{ "traversal", benchTraversal },
+		{ "occupancy", benchOccupancy },
+		{ "distance", benchDistance },
+		{ "raycast", benchRaycast },
+		{ "terrain", benchTerrain },
+		{ "jobs", benchJobs },
+		{ "file", benchWorldFile },
+		{ "map", benchMappedWorld },
+		{ "stream", benchStreamedWorld }
+	};
+
+	int count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+	bool ran = false;
+
+	for (int i = 0; i < count; i++) {
+		if (argc < 2 || strcmp(argv[1], benchmarks[i].name) == 0) {
+			benchmarks[i].func();
+			printf("\n");
+			ran = true;
+		}
+	}
+
+	if (!ran) {
+		printf("usage: %s [benchmark]\n\nbenchmarks:", argv[0]);
+		for (int i = 0; i < count; i++) printf(" %s", benchmarks[i].name);
+		printf("\n");
+		return 1;
+	}
+
+	return 0;
+}
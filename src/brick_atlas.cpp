@@ -0,0 +1,213 @@
+#include <rc/brick_atlas.hpp>
+
+#include <algorithm>
+#include <utility>
+
+namespace rc
+{
+	const uint32_t brick_atlas::UNIFORM_BIT;
+	const uint32_t brick_atlas::EMPTY_REGION_BIT;
+	const uint32_t brick_atlas::PROXY_BIT;
+	const int brick_atlas::MAX_LOADS;
+
+	brick_atlas::brick_atlas()
+	{
+		bsx = bsy = bsz = 0;
+		slotAxis = 0;
+		frame = 0;
+	}
+
+	void brick_atlas::reset(const world& w, int slotsPerAxis)
+	{
+		bsx = w.bricksX();
+		bsy = w.bricksY();
+		bsz = w.bricksZ();
+		slotAxis = slotsPerAxis;
+		frame = 0;
+
+		// Every slot starts out free, lowest index first
+		slotBricks.assign(slotCount(), -1);
+		slotUsed.assign(slotCount(), 0);
+		freeSlots.resize(slotCount());
+		for (int i = 0; i < slotCount(); i++)
+			freeSlots[i] = slotCount() - 1 - i;
+
+		entries.resize(bsx * bsy * bsz);
+		for (int bz = 0; bz < bsz; bz++)
+			for (int by = 0; by < bsy; by++)
+				for (int bx = 0; bx < bsx; bx++)
+					entries[toBrickIndex(bx, by, bz)] = describeBrick(w, bx, by, bz);
+
+		changed.assign(1, box(glm::ivec3(0, 0, 0), glm::ivec3(bsx, bsy, bsz)));
+		loaded.clear();
+	}
+
+	void brick_atlas::invalidate(const world& w, const box& region)
+	{
+		// Emptiness of a brick also depends on the rest of the 64^3 region around it
+		glm::ivec3 brickMin = (region.min / 64) * 4;
+		glm::ivec3 brickMax = glm::min(((region.max + 63) / 64) * 4, glm::ivec3(bsx, bsy, bsz));
+
+		// The occupancy masks uploaded with the entries of the changed bricks may be different, even if the entries aren't
+		glm::ivec3 changedMin = region.min / world::BRICK_SIZE;
+		glm::ivec3 changedMax = glm::min((region.max + world::BRICK_SIZE - 1) / world::BRICK_SIZE, glm::ivec3(bsx, bsy, bsz));
+		mergeRegion(changed, box(changedMin, changedMax));
+
+		for (int bz = brickMin.z; bz < brickMax.z; bz++) {
+			for (int by = brickMin.y; by < brickMax.y; by++) {
+				for (int bx = brickMin.x; bx < brickMax.x; bx++) {
+					uint32_t entry = entries[toBrickIndex(bx, by, bz)];
+					bool resident = (entry & UNIFORM_BIT) == 0;
+
+					if (resident && w.isUniformBrick(bx, by, bz)) {
+						freeSlot(entry);
+						setEntry(bx, by, bz, describeBrick(w, bx, by, bz));
+					} else if (resident) {
+						// Refill the slot if the brick itself was changed
+						glm::ivec3 brickStart = glm::ivec3(bx, by, bz) * world::BRICK_SIZE;
+
+						if (glm::all(glm::lessThan(brickStart, region.max)) && glm::all(glm::greaterThan(brickStart + world::BRICK_SIZE, region.min)))
+							loaded.push_back(entry);
+					} else {
+						setEntry(bx, by, bz, describeBrick(w, bx, by, bz));
+					}
+				}
+			}
+		}
+	}
+
+	void brick_atlas::update(const world& w, const glm::vec3& pos)
+	{
+		frame++;
+
+		// Cube of bricks around the position that always fits in the atlas
+		glm::ivec3 center = glm::ivec3(glm::floor(pos / float(world::BRICK_SIZE)));
+		glm::ivec3 cubeMin = glm::max(center - slotAxis / 2, glm::ivec3(0));
+		glm::ivec3 cubeMax = glm::min(center - slotAxis / 2 + slotAxis, glm::ivec3(bsx, bsy, bsz));
+
+		// Keep the resident bricks in the cube and find the expanded ones that are missing
+		std::vector<std::pair<int, int>> missing;
+
+		for (int bz = cubeMin.z; bz < cubeMax.z; bz++) {
+			for (int by = cubeMin.y; by < cubeMax.y; by++) {
+				for (int bx = cubeMin.x; bx < cubeMax.x; bx++) {
+					int i = toBrickIndex(bx, by, bz);
+
+					if ((entries[i] & UNIFORM_BIT) == 0) {
+						slotUsed[entries[i]] = frame;
+					} else if (!w.isUniformBrick(bx, by, bz)) {
+						glm::ivec3 d = glm::ivec3(bx, by, bz) - center;
+						missing.push_back(std::make_pair(d.x * d.x + d.y * d.y + d.z * d.z, i));
+					}
+				}
+			}
+		}
+
+		if (missing.empty()) return;
+
+		std::sort(missing.begin(), missing.end());
+		if (missing.size() > MAX_LOADS) missing.resize(MAX_LOADS);
+
+		// Slots that weren't needed by this update, least recently used first
+		std::vector<std::pair<uint64_t, int>> unused;
+
+		if (freeSlots.size() < missing.size()) {
+			for (int i = 0; i < slotCount(); i++)
+				if (slotBricks[i] >= 0 && slotUsed[i] < frame)
+					unused.push_back(std::make_pair(slotUsed[i], i));
+
+			std::sort(unused.begin(), unused.end());
+		}
+
+		size_t nextUnused = 0;
+
+		for (size_t i = 0; i < missing.size(); i++) {
+			if (freeSlots.empty()) {
+				if (nextUnused == unused.size()) break;
+
+				// Evict the least recently used brick, which falls back to its proxy
+				int evicted = unused[nextUnused++].second;
+				glm::ivec3 b = slotBrick(evicted);
+
+				freeSlot(evicted);
+				setEntry(b.x, b.y, b.z, describeBrick(w, b.x, b.y, b.z));
+			}
+
+			int slot = freeSlots.back();
+			freeSlots.pop_back();
+
+			int brick = missing[i].second;
+			slotBricks[slot] = brick;
+			slotUsed[slot] = frame;
+
+			int bx = brick % bsx, by = (brick / bsx) % bsy, bz = brick / (bsx * bsy);
+			setEntry(bx, by, bz, slot);
+			loaded.push_back(slot);
+		}
+	}
+
+	glm::ivec3 brick_atlas::slotBrick(int slot) const
+	{
+		int brick = slotBricks[slot];
+		if (brick < 0) return glm::ivec3(-1);
+
+		return glm::ivec3(brick % bsx, (brick / bsx) % bsy, brick / (bsx * bsy));
+	}
+
+	glm::ivec3 brick_atlas::slotOrigin(int slot) const
+	{
+		return glm::ivec3(slot % slotAxis, (slot / slotAxis) % slotAxis, slot / (slotAxis * slotAxis)) * world::BRICK_SIZE;
+	}
+
+	void brick_atlas::clearChanges()
+	{
+		changed.clear();
+		loaded.clear();
+	}
+
+	uint32_t brick_atlas::describeBrick(const world& w, int bx, int by, int bz) const
+	{
+		if (w.isUniformBrick(bx, by, bz)) {
+			uint32_t mat = w.brickMaterial(bx, by, bz);
+
+			if (mat == material::EMPTY && w.emptyLevels(bx * world::BRICK_SIZE, by * world::BRICK_SIZE, bz * world::BRICK_SIZE) == 3)
+				return UNIFORM_BIT | EMPTY_REGION_BIT | mat;
+			else
+				return UNIFORM_BIT | mat;
+		}
+
+		// Bricks that aren't resident have the shape of their occupancy and their most common solid material
+		if (w.brickOccupancy(bx, by, bz) == 0)
+			return UNIFORM_BIT | material::EMPTY;
+
+		block_span blocks = w.brickData(bx, by, bz);
+		int counts[256] = {};
+
+		for (size_t i = 0; i < blocks.size(); i++)
+			counts[blocks[i]]++;
+
+		int mat = 1;
+		for (int i = 2; i < 256; i++)
+			if (counts[i] > counts[mat]) mat = i;
+
+		return UNIFORM_BIT | PROXY_BIT | mat;
+	}
+
+	void brick_atlas::setEntry(int bx, int by, int bz, uint32_t entry)
+	{
+		uint32_t& e = entries[toBrickIndex(bx, by, bz)];
+
+		if (e != entry) {
+			e = entry;
+			mergeRegion(changed, box(glm::ivec3(bx, by, bz), glm::ivec3(bx + 1, by + 1, bz + 1)));
+		}
+	}
+
+	void brick_atlas::freeSlot(int slot)
+	{
+		if (slotBricks[slot] < 0) return;
+
+		slotBricks[slot] = -1;
+		freeSlots.push_back(slot);
+	}
+}
@@ -0,0 +1,329 @@
+#include <rc/cpu_renderer.hpp>
+#include <rc/jobs.hpp>
+#include <rc/voxel_ray.hpp>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <SOIL.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace rc
+{
+	// Size of the square tiles handed to worker threads
+	static const int TILE_SIZE = 16;
+
+	/*
+		The functions of renderer.frag for a world with a specific layout
+	*/
+	template <typename Layout>
+	class cpu_tracer
+	{
+	public:
+		cpu_tracer(const cpu_renderer& r, const basic_world<Layout>& w) : r(r), w(w), rays(0), useDistanceField(w.hasDistanceField()) {}
+
+		static void renderTile(cpu_renderer& r, int x0, int y0, int x1, int y1, uint64_t& rays)
+		{
+			cpu_tracer t(r, *static_cast<const basic_world<Layout>*>(r.currentWorld));
+
+			for (int y = y0; y < y1; y++) {
+				// Framebuffer rows are stored top first, but window coordinates start at the bottom
+				uint8_t* row = &r.framebuffer[(r.frameHeight - 1 - y) * r.frameWidth * 4];
+
+				for (int x = x0; x < x1; x++) {
+					glm::vec2 position((x + 0.5f) / r.frameWidth * 2.0f - 1.0f, (y + 0.5f) / r.frameHeight * 2.0f - 1.0f);
+					glm::vec4 color = glm::clamp(t.shade(position), 0.0f, 1.0f);
+
+					for (int i = 0; i < 4; i++)
+						row[x * 4 + i] = uint8_t(color[i] * 255.0f + 0.5f);
+				}
+			}
+
+			rays += t.rays;
+		}
+
+	private:
+		const cpu_renderer& r;
+		const basic_world<Layout>& w;
+		uint64_t rays;
+		bool useDistanceField;
+
+		// Project screen space vector in object space
+		glm::vec3 unproject(glm::vec2 coord) const
+		{
+			glm::vec4 v = r.invProjView * glm::vec4(coord, 1.0f, 1.0f);
+			return glm::normalize(glm::vec3(v));
+		}
+
+		// Get the material of the block at the specified position in the world
+		int getBlock(glm::ivec3 coords) const
+		{
+			return w.get(coords.x, coords.y, coords.z);
+		}
+
+		// Nearest neighbour lookup with repeat wrapping, like the materials sampler
+		glm::vec4 texture(glm::vec2 uv) const
+		{
+			if (r.materials.empty())
+				return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+			int tx = std::min(int((uv.x - std::floor(uv.x)) * r.materialsWidth), r.materialsWidth - 1);
+			int ty = std::min(int((uv.y - std::floor(uv.y)) * r.materialsHeight), r.materialsHeight - 1);
+			const uint8_t* texel = &r.materials[(ty * r.materialsWidth + tx) * 4];
+
+			return glm::vec4(texel[0], texel[1], texel[2], texel[3]) / 255.0f;
+		}
+
+		// Get the color of a block at a certain point
+		glm::vec4 blockColor(glm::ivec3 block, glm::vec3 pos, glm::vec3 normal) const
+		{
+			glm::vec3 localPos = pos - glm::vec3(block);
+			int mat = getBlock(block);
+			float materialCount = r.materialCount;
+			float matOffset = float(mat - 1) * 1.0f / materialCount;
+
+			// Exception for grass, which uses the dirt texture on the sides if a block is on top of it
+			if (mat == 1 && std::abs(normal.x) + std::abs(normal.y) > 0.0f && getBlock(block + glm::ivec3(0, 0, 1)) != 0) {
+				if (std::abs(normal.x) > 0.0f) {
+					return texture(glm::vec2(matOffset + localPos.y / materialCount, 0.5f - localPos.z / 4.0f));
+				} else {
+					return texture(glm::vec2(matOffset + localPos.x / materialCount, 0.5f - localPos.z / 4.0f));
+				}
+			}
+
+			if (normal.z > 0.0f) {
+				return texture(glm::vec2(matOffset + localPos.x / materialCount, 0.25f - localPos.y / materialCount));
+			} else if (normal.z < 0.0f) {
+				return texture(glm::vec2(matOffset + localPos.x / materialCount, 0.5f - localPos.y / 4.0f));
+			} else if (std::abs(normal.x) > 0.0f) {
+				return texture(glm::vec2(matOffset + localPos.y / materialCount, 0.75f - localPos.z / 4.0f));
+			} else {
+				return texture(glm::vec2(matOffset + localPos.x / materialCount, 1.0f - localPos.z / 4.0f));
+			}
+		}
+
+		// Traces a single ray and returns the resulting color
+		glm::vec4 rayTrace(glm::vec3 rayStart, glm::vec3 rayDir, bool& hit, glm::ivec3& hitBlock, glm::vec3& hitPos, glm::vec3& hitNormal)
+		{
+			hit = false;
+			rays++;
+
+			// Find the first position inside the world that is hit
+			voxel_ray ray(rayStart, rayDir, glm::ivec3(w.sizeX(), w.sizeY(), w.sizeZ()));
+			if (!ray.hitsGrid())
+				return r.skyColor;
+
+			// The block containing the start of the ray is skipped, like the block it was cast from
+			if (ray.startedInside())
+				ray.step();
+
+			// Iterate until the end of the world has been reached
+			for (int iterations = 0; iterations < r.maxIterations && ray.inside(); iterations++)
+			{
+				glm::ivec3 coord = ray.block();
+
+				// Jump over the cube of blocks closer than the nearest solid block at once
+				int dist = useDistanceField ? w.distanceToSolid(coord.x, coord.y, coord.z) : 0;
+
+				if (dist > 1) {
+					ray.skip(coord - (dist - 1), coord + dist);
+					continue;
+				}
+
+				// Otherwise jump over the largest empty node around the block
+				int span = w.emptySpan(coord.x, coord.y, coord.z);
+
+				if (span > 1) {
+					glm::ivec3 nodeMin(coord.x & ~(span - 1), coord.y & ~(span - 1), coord.z & ~(span - 1));
+					ray.skip(nodeMin, nodeMin + span);
+					continue;
+				}
+
+				// Only blocks that can be hit need their color
+				if (span == 0) {
+					glm::vec3 hitP = ray.position();
+					glm::vec3 hitN = glm::vec3(ray.normal());
+					glm::vec4 hitColor = blockColor(coord, hitP, hitN);
+
+					if (hitColor.r < 0.9f || hitColor.g > 0.1f || hitColor.b < 0.9f) {
+						hit = true;
+						hitBlock = coord;
+						hitPos = hitP;
+						hitNormal = hitN;
+
+						return hitColor;
+					}
+				}
+
+				ray.step();
+			}
+
+			return r.skyColor;
+		}
+
+		// Color of a single pixel, the equivalent of main() in the shader
+		glm::vec4 shade(glm::vec2 position)
+		{
+			bool hit;
+			glm::ivec3 hitBlock;
+			glm::vec3 hitPos, hitNormal;
+			glm::vec3 initialNormal = unproject(position);
+
+			// Initial trace
+			glm::vec4 outColor = rayTrace(r.viewOrigin, initialNormal, hit, hitBlock, hitPos, hitNormal);
+			glm::ivec3 rootHitBlock = hitBlock;
+			glm::vec3 rootHitPos = hitPos;
+			glm::vec3 rootHitNormal = hitNormal;
+
+			// If a block was hit, do a simple lighting trace
+			if (hit) {
+				rayTrace(hitPos + hitNormal * 0.001f, glm::vec3(1, 1, 1), hit, hitBlock, hitPos, hitNormal);
+
+				if (hit) {
+					outColor = glm::vec4(glm::vec3(outColor) / 2.0f, outColor.a);
+				} else {
+					// If a gold block was hit, do a simple reflection trace
+					if (getBlock(rootHitBlock) == 5) {
+						glm::vec3 reflectNormal = 2.0f * rootHitNormal * glm::dot(initialNormal, rootHitNormal) - initialNormal;
+						glm::vec4 col = rayTrace(rootHitPos + rootHitNormal * 0.001f, -reflectNormal, hit, hitBlock, hitPos, hitNormal);
+
+						// Do lighting trace for reflection
+						if (hit) {
+							rayTrace(hitPos + hitNormal * 0.001f, glm::vec3(1, 1, 1), hit, hitBlock, hitPos, hitNormal);
+
+							if (hit) {
+								col /= 2.0f;
+							}
+						}
+
+						outColor = glm::mix(outColor, col, 0.3f);
+					}
+				}
+			}
+
+			return outColor;
+		}
+	};
+
+	cpu_renderer::cpu_renderer(int width, int height)
+	{
+		frameWidth = width;
+		frameHeight = height;
+		framebuffer = std::vector<uint8_t>(width * height * 4);
+		threadCount = 0;
+		rays = 0;
+
+		// Load resources
+		loadMaterialTexture();
+
+		// Set defaults
+		setSkyColor(glm::vec3(127.0f/255.0f, 204.0f/255.0f, 255.0f/255.0f));
+
+		// Nothing to trace until world is assigned
+		currentWorld = nullptr;
+		renderTile = nullptr;
+		maxIterations = 0;
+	}
+
+	template <typename Layout>
+	void cpu_renderer::setWorld(const basic_world<Layout>& w)
+	{
+		currentWorld = &w;
+		renderTile = &cpu_tracer<Layout>::renderTile;
+
+		// Set iteration limit based on world size
+		maxIterations = w.sizeX() + w.sizeY() + w.sizeZ();
+	}
+
+	void cpu_renderer::setSkyColor(const glm::vec3& color)
+	{
+		skyColor = glm::vec4(color, 1.0f);
+	}
+
+	void cpu_renderer::setCameraDir(const glm::vec3& pos, const glm::vec3& dir, float fov, float aspect)
+	{
+		setCameraTarget(pos, pos + dir, fov, aspect);
+	}
+
+	void cpu_renderer::setCameraTarget(const glm::vec3& pos, const glm::vec3& target, float fov, float aspect)
+	{
+		// Same projection as the GPU renderer
+		glm::mat4 proj = glm::perspective(fov, aspect, 1.0f, 1000.f);
+		glm::mat4 view = glm::lookAt(pos, target, glm::vec3(0.0f, 0.0f, 1.0f));
+		invProjView = glm::inverse(proj * view);
+		viewOrigin = pos;
+	}
+
+	void cpu_renderer::setThreadCount(int threads)
+	{
+		threadCount = threads;
+	}
+
+	void cpu_renderer::drawFrame()
+	{
+		rays = 0;
+		if (renderTile == nullptr) return;
+
+		int tilesX = (frameWidth + TILE_SIZE - 1) / TILE_SIZE;
+		int tilesY = (frameHeight + TILE_SIZE - 1) / TILE_SIZE;
+
+		// Tiles are handed out to the threads of the shared pool
+		std::atomic<uint64_t> totalRays(0);
+
+		jobs::shared().parallelFor(box(glm::ivec3(0, 0, 0), glm::ivec3(tilesX, tilesY, 1)), glm::ivec3(1, 1, 1), [&] (const box& tiles) {
+			uint64_t tileRays = 0;
+			int x0 = tiles.min.x * TILE_SIZE;
+			int y0 = tiles.min.y * TILE_SIZE;
+
+			renderTile(*this, x0, y0, std::min(x0 + TILE_SIZE, frameWidth), std::min(y0 + TILE_SIZE, frameHeight), tileRays);
+			totalRays += tileRays;
+		}, threadCount);
+
+		rays = totalRays;
+	}
+
+	int cpu_renderer::width() const { return frameWidth; }
+	int cpu_renderer::height() const { return frameHeight; }
+
+	const uint8_t* cpu_renderer::pixels() const
+	{
+		return &framebuffer[0];
+	}
+
+	uint64_t cpu_renderer::rayCount() const
+	{
+		return rays;
+	}
+
+	void cpu_renderer::loadMaterialTexture()
+	{
+		int w, h;
+		unsigned char* pixels = SOIL_load_image("materials.png", &w, &h, 0, SOIL_LOAD_RGBA);
+		if (pixels == NULL) pixels = SOIL_load_image("bin/materials.png", &w, &h, 0, SOIL_LOAD_RGBA);
+
+		if (pixels == NULL) {
+			printf("Couldn't load texture file 'materials.png'!\n");
+			materialsWidth = materialsHeight = 0;
+			materialCount = 1;
+			return;
+		}
+
+		// Materials are columns of square tiles for the four kinds of faces, like for the GPU renderer
+		materialCount = float(4 * w / h);
+
+		materials = std::vector<uint8_t>(pixels, pixels + w * h * 4);
+		materialsWidth = w;
+		materialsHeight = h;
+
+		SOIL_free_image_data(pixels);
+	}
+
+	template void cpu_renderer::setWorld(const basic_world<layout::linear>& w);
+	template void cpu_renderer::setWorld(const basic_world<layout::morton>& w);
+	template void cpu_renderer::setWorld(const basic_world<layout::tiled>& w);
+}
@@ -0,0 +1,308 @@
+#include <rc/jobs.hpp>
+
+#include <algorithm>
+
+#ifdef _MSC_VER
+#	define RC_THREAD_LOCAL __declspec(thread)
+#else
+#	define RC_THREAD_LOCAL __thread
+#endif
+
+namespace rc
+{
+	namespace jobs
+	{
+		const int pool::CHUNKS_PER_THREAD;
+
+		struct task_state
+		{
+			task_func func;
+
+			// Dependencies that haven't finished yet, plus one until the task has been submitted
+			std::atomic<int> pending;
+			std::atomic<bool> finished;
+
+			// Tasks that wait for this one, guarded by mutex together with finished
+			std::mutex mutex;
+			std::vector<std::shared_ptr<task_state>> dependents;
+		};
+
+		// Pool and deque of the worker running on the calling thread
+		static RC_THREAD_LOCAL const pool* currentPool = nullptr;
+		static RC_THREAD_LOCAL int currentWorker = -1;
+
+		// Not function statics, which aren't initialized thread safely by every supported compiler
+		static std::once_flag sharedCreated;
+		static std::unique_ptr<pool> sharedPool;
+
+		bool task::done() const
+		{
+			return !state || state->finished;
+		}
+
+		pool::pool(int threads)
+		{
+			if (threads <= 0) threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+			this->threads = threads;
+			this->queued = 0;
+			this->waiting = 0;
+			this->stopping = false;
+
+			for (int i = 0; i < threads; i++)
+				queues.push_back(std::unique_ptr<queue>(new queue()));
+
+			// The thread that waits is one of the threads, so it needs one worker less
+			for (int i = 0; i < threads - 1; i++)
+				workers.push_back(std::thread(&pool::workerLoop, this, i));
+		}
+
+		pool::~pool()
+		{
+			// Help with the queued tasks, a pool without workers wouldn't run them otherwise
+			for (std::shared_ptr<task_state> t = findTask(queueIndex()); t; t = findTask(queueIndex()))
+				run(t);
+
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				stopping = true;
+			}
+
+			wake.notify_all();
+
+			for (int i = 0; i < workers.size(); i++)
+				workers[i].join();
+		}
+
+		int pool::threadCount() const
+		{
+			return threads;
+		}
+
+		task pool::submit(const task_func& func)
+		{
+			return submit(func, std::vector<task>());
+		}
+
+		task pool::submit(const task_func& func, const task& dependency)
+		{
+			return submit(func, std::vector<task>(1, dependency));
+		}
+
+		task pool::submit(const task_func& func, const std::vector<task>& dependencies)
+		{
+			std::shared_ptr<task_state> t = std::make_shared<task_state>();
+			t->func = func;
+			t->pending = 1;
+			t->finished = false;
+
+			for (int i = 0; i < dependencies.size(); i++) {
+				task_state* dep = dependencies[i].state.get();
+				if (dep == nullptr) continue;
+
+				std::lock_guard<std::mutex> lock(dep->mutex);
+
+				if (!dep->finished) {
+					t->pending++;
+					dep->dependents.push_back(t);
+				}
+			}
+
+			if (--t->pending == 0) push(t);
+
+			return task(t);
+		}
+
+		void pool::wait(const task& t)
+		{
+			int self = queueIndex();
+
+			while (!t.done()) {
+				std::shared_ptr<task_state> other = findTask(self);
+
+				if (other) {
+					run(other);
+					continue;
+				}
+
+				// Nothing to help with, so sleep until a task finishes or more work is queued
+				waiting++;
+
+				{
+					std::unique_lock<std::mutex> lock(sleepMutex);
+					while (!t.done() && queued == 0)
+						wake.wait(lock);
+				}
+
+				waiting--;
+			}
+		}
+
+		void pool::wait(const std::vector<task>& tasks)
+		{
+			for (int i = 0; i < tasks.size(); i++)
+				wait(tasks[i]);
+		}
+
+		void pool::parallelFor(const box& range, const glm::ivec3& chunk, const range_func& func, int maxThreads)
+		{
+			if (range.empty()) return;
+
+			int n = maxThreads > 0 ? std::min(maxThreads, threads) : threads;
+			glm::ivec3 size = range.max - range.min;
+
+			// Split the axes without a hint until there are enough chunks, outermost axis first
+			glm::ivec3 c;
+			for (int axis = 0; axis < 3; axis++)
+				c[axis] = chunk[axis] > 0 ? std::min(chunk[axis], size[axis]) : size[axis];
+
+			for (int axis = 2; axis >= 0; axis--) {
+				if (chunk[axis] > 0) continue;
+
+				glm::ivec3 counts = (size + c - 1) / c;
+				int count = counts.x * counts.y * counts.z;
+				int pieces = std::min(size[axis], (n * CHUNKS_PER_THREAD + count - 1) / count);
+
+				c[axis] = (size[axis] + pieces - 1) / pieces;
+			}
+
+			glm::ivec3 counts = (size + c - 1) / c;
+			int count = counts.x * counts.y * counts.z;
+
+			// Every thread takes chunks until none are left, so no chunk has to be queued separately
+			std::atomic<int> next(0);
+
+			auto work = [&] () {
+				for (int i = next++; i < count; i = next++) {
+					glm::ivec3 index(i % counts.x, (i / counts.x) % counts.y, i / (counts.x * counts.y));
+					glm::ivec3 min = range.min + index * c;
+
+					func(box(min, glm::min(min + c, range.max)));
+				}
+			};
+
+			std::vector<task> helpers;
+			for (int i = 1; i < std::min(n, count); i++)
+				helpers.push_back(submit(work));
+
+			work();
+			wait(helpers);
+		}
+
+		void pool::parallelFor(int begin, int end, int chunk, const index_func& func, int maxThreads)
+		{
+			parallelFor(box(glm::ivec3(begin, 0, 0), glm::ivec3(end, 1, 1)), glm::ivec3(chunk, 1, 1), [&] (const box& b) {
+				func(b.min.x, b.max.x);
+			}, maxThreads);
+		}
+
+		int pool::queueIndex() const
+		{
+			return currentPool == this ? currentWorker : threads - 1;
+		}
+
+		void pool::push(const std::shared_ptr<task_state>& t)
+		{
+			queue& q = *queues[queueIndex()];
+
+			{
+				std::lock_guard<std::mutex> lock(q.mutex);
+				q.tasks.push_back(t);
+			}
+
+			queued++;
+
+			// Taking the lock orders the notification after a sleeping thread checked for work
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+			}
+
+			if (waiting > 0)
+				wake.notify_all();
+			else
+				wake.notify_one();
+		}
+
+		std::shared_ptr<task_state> pool::findTask(int self)
+		{
+			std::shared_ptr<task_state> t;
+			if (queued == 0) return t;
+
+			// Newest task of the own deque first, then the oldest task of the others
+			for (int i = 0; i < threads && !t; i++) {
+				queue& q = *queues[(self + i) % threads];
+				std::lock_guard<std::mutex> lock(q.mutex);
+
+				if (q.tasks.empty()) continue;
+
+				if (i == 0 && currentPool == this) {
+					t = q.tasks.back();
+					q.tasks.pop_back();
+				} else {
+					t = q.tasks.front();
+					q.tasks.pop_front();
+				}
+			}
+
+			if (t) queued--;
+
+			return t;
+		}
+
+		void pool::run(const std::shared_ptr<task_state>& t)
+		{
+			t->func();
+			t->func = task_func();
+
+			std::vector<std::shared_ptr<task_state>> ready;
+
+			{
+				std::lock_guard<std::mutex> lock(t->mutex);
+				t->finished = true;
+				ready.swap(t->dependents);
+			}
+
+			for (int i = 0; i < ready.size(); i++)
+				if (--ready[i]->pending == 0) push(ready[i]);
+
+			// Wake the threads waiting for tasks to finish
+			if (waiting > 0) {
+				{
+					std::lock_guard<std::mutex> lock(sleepMutex);
+				}
+
+				wake.notify_all();
+			}
+		}
+
+		void pool::workerLoop(int index)
+		{
+			currentPool = this;
+			currentWorker = index;
+
+			while (true) {
+				std::shared_ptr<task_state> t = findTask(index);
+
+				if (t) {
+					run(t);
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				if (stopping && queued == 0) break;
+
+				while (queued == 0 && !stopping)
+					wake.wait(lock);
+			}
+		}
+
+		pool& shared()
+		{
+			std::call_once(sharedCreated, [] () {
+				sharedPool.reset(new pool());
+			});
+
+			return *sharedPool;
+		}
+	}
+}
@@ -1,42 +1,194 @@
 // Raycraft internals
 #include <rc/world.hpp>
 #include <rc/renderer.hpp>
+#include <rc/cpu_renderer.hpp>
+#include <rc/scenes.hpp>
+#include <rc/world_file.hpp>
 
 #include <GL/glfw.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
 
 // Configuration
 const int WIDTH = 1280;
 const int HEIGHT = 720;
 
-int main()
+// Largest world that gets a distance field, which takes a byte per block and has to read every block
+const long long MAX_DISTANCE_FIELD_VOLUME = 512LL * 512 * 512;
+
+/*
+	Headless benchmark that renders a scene along its camera path with the CPU
+	tracer and reports frame time statistics
+
+	raycraft --bench <scene> [--size N] [--frames N] [--resolution WxH]
+	         [--threads N] [--distance-field] [--out results.csv|results.json]
+*/
+struct bench_options
 {
-	// Initialize glfw
-	glfwInit();
+	std::string scene;
+	int size, frames, width, height, threads;
+	bool distanceField;
+	std::string out;
+};
 
-	// Open window
-	glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
-	glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 3);
-	glfwOpenWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	glfwOpenWindowHint(GLFW_WINDOW_NO_RESIZE, GL_TRUE);
-	glfwOpenWindow(WIDTH, HEIGHT, 0, 0, 0, 0, 0, 0, GLFW_WINDOW);
-	glfwSetWindowTitle("raycraft");
-	glfwSwapInterval(1);
+// Frame time at a percentile of the sorted times, by nearest rank
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	int rank = int(std::ceil(p * sorted.size()));
+	return sorted[std::min(std::max(rank, 1), int(sorted.size())) - 1];
+}
 
-	// Center window on screen
-	GLFWvidmode videoMode;
-	glfwGetDesktopMode(&videoMode);
-	glfwSetWindowPos(videoMode.Width / 2 - WIDTH / 2, videoMode.Height / 2 - HEIGHT / 2);
+static bool parseBenchOptions(int argc, char* argv[], bench_options& opt)
+{
+	opt.size = 256;
+	opt.frames = 100;
+	opt.width = WIDTH;
+	opt.height = HEIGHT;
+	opt.threads = 0;
+	opt.distanceField = false;
+
+	if (argc < 1) return false;
+	opt.scene = argv[0];
+
+	for (int i = 1; i < argc; i++) {
+		bool hasValue = i + 1 < argc;
+
+		if (strcmp(argv[i], "--size") == 0 && hasValue) {
+			opt.size = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+			opt.frames = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--resolution") == 0 && hasValue) {
+			if (sscanf(argv[++i], "%dx%d", &opt.width, &opt.height) != 2) return false;
+		} else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+			opt.threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--distance-field") == 0) {
+			opt.distanceField = true;
+		} else if (strcmp(argv[i], "--out") == 0 && hasValue) {
+			opt.out = argv[++i];
+		} else {
+			return false;
+		}
+	}
+
+	return opt.size >= 16 && opt.frames > 0 && opt.width > 0 && opt.height > 0;
+}
+
+static int runBenchmark(int argc, char* argv[])
+{
+	bench_options opt;
+
+	if (!parseBenchOptions(argc, argv, opt)) {
+		printf("usage: raycraft --bench <scene> [--size N] [--frames N] [--resolution WxH] [--threads N] [--distance-field] [--out results.csv|results.json]\n\nscenes:");
+		for (int i = 0; rc::scenes::names[i] != nullptr; i++) printf(" %s", rc::scenes::names[i]);
+		printf("\n");
+		return 1;
+	}
+
+	// Build world
+	rc::world world(opt.size, opt.size, opt.size / 2);
+
+	if (!rc::scenes::build(opt.scene, world)) {
+		printf("Unknown scene '%s'!\n", opt.scene.c_str());
+		return 1;
+	}
+
+	if (opt.distanceField)
+		world.buildDistanceField();
+
+	rc::cpu_renderer renderer(opt.width, opt.height);
+	renderer.setWorld(world);
+	renderer.setThreadCount(opt.threads);
+
+	// Render the path once without measuring to warm up caches
+	std::vector<double> frameTimes(opt.frames);
+	uint64_t rays = 0;
+
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < (pass == 0 ? 1 : opt.frames); i++) {
+			glm::vec3 pos, target;
+			rc::scenes::cameraPath(opt.scene, world, i, opt.frames, pos, target);
+			renderer.setCameraTarget(pos, target, 70.0f, (float)opt.width / (float)opt.height);
+
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			renderer.drawFrame();
+
+			if (pass == 1) {
+				frameTimes[i] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+				rays += renderer.rayCount();
+			}
+		}
+	}
+
+	// Summarize
+	std::vector<double> sorted = frameTimes;
+	std::sort(sorted.begin(), sorted.end());
+
+	double total = 0.0;
+	for (int i = 0; i < opt.frames; i++) total += frameTimes[i];
+
+	double minMs = sorted[0], medianMs = percentile(sorted, 0.5), p95Ms = percentile(sorted, 0.95), p99Ms = percentile(sorted, 0.99);
+	double raysPerSecond = rays / (total / 1000.0);
+
+	printf("%s %d^2 at %dx%d, %d frames: min %.2f ms, median %.2f ms, p95 %.2f ms, p99 %.2f ms, %.2f Mrays/s\n", opt.scene.c_str(), opt.size, opt.width, opt.height, opt.frames, minMs, medianMs, p95Ms, p99Ms, raysPerSecond / 1e6);
+
+	if (opt.out.empty()) return 0;
+
+	bool json = opt.out.size() >= 5 && opt.out.compare(opt.out.size() - 5, 5, ".json") == 0;
+
+	if (json) {
+		// Complete results including the time of every frame
+		FILE* f = fopen(opt.out.c_str(), "w");
+		if (f == nullptr) {
+			printf("Couldn't write '%s'!\n", opt.out.c_str());
+			return 1;
+		}
+
+		fprintf(f, "{\n\t\"scene\": \"%s\",\n\t\"size\": %d,\n\t\"width\": %d,\n\t\"height\": %d,\n\t\"threads\": %d,\n\t\"distanceField\": %s,\n", opt.scene.c_str(), opt.size, opt.width, opt.height, opt.threads, opt.distanceField ? "true" : "false");
+		fprintf(f, "\t\"minMs\": %.4f,\n\t\"medianMs\": %.4f,\n\t\"p95Ms\": %.4f,\n\t\"p99Ms\": %.4f,\n\t\"raysPerSecond\": %.0f,\n\t\"frameMs\": [", minMs, medianMs, p95Ms, p99Ms, raysPerSecond);
+
+		for (int i = 0; i < opt.frames; i++)
+			fprintf(f, "%s%.4f", i > 0 ? ", " : "", frameTimes[i]);
 
-	// Create simple world
-	rc::world world(20, 20, 20);
+		fprintf(f, "]\n}\n");
+		fclose(f);
+	} else {
+		// One summary row per run, so that runs can be collected in the same file
+		FILE* f = fopen(opt.out.c_str(), "r");
+		bool exists = f != nullptr;
+		if (exists) fclose(f);
+
+		f = fopen(opt.out.c_str(), "a");
+		if (f == nullptr) {
+			printf("Couldn't write '%s'!\n", opt.out.c_str());
+			return 1;
+		}
+
+		if (!exists)
+			fprintf(f, "scene,size,width,height,threads,distance_field,frames,min_ms,median_ms,p95_ms,p99_ms,rays_per_second\n");
+
+		fprintf(f, "%s,%d,%d,%d,%d,%d,%d,%.4f,%.4f,%.4f,%.4f,%.0f\n", opt.scene.c_str(), opt.size, opt.width, opt.height, opt.threads, opt.distanceField ? 1 : 0, opt.frames, minMs, medianMs, p95Ms, p99Ms, raysPerSecond);
+		fclose(f);
+	}
+
+	return 0;
+}
+
+// Small world with a few of every material
+static void buildDemoWorld(rc::world& world)
+{
 	world.createFlatWorld(5);
 
 	// Shiny gold wall
-	for (int x = 13; x <= 18; x++)
-		for (int z = 5; z <= 8; z++)
-			world.set(x, 5, z, rc::material::GOLD);
+	world.fill(rc::box(glm::ivec3(13, 5, 5), glm::ivec3(19, 6, 9)), rc::material::GOLD);
 
 	// Arch being reflected
 	world.set(17, 8, 5, rc::material::GRASS);
@@ -54,16 +206,104 @@ int main()
 	// Tree
 	world.set(8, 12, 5, rc::material::WOOD);
 	world.set(8, 12, 6, rc::material::WOOD);
-	for (int x = 7; x <= 9; x++)
-		for (int y = 11; y <= 13; y++)
-			for (int z = 7; z <= 9; z++)
-				world.set(x, y, z, rc::material::LEAF);
+	world.fill(rc::box(glm::ivec3(7, 11, 7), glm::ivec3(10, 14, 10)), rc::material::LEAF);
 	world.set(8, 12, 7, rc::material::WOOD);
+}
+
+/*
+	Build a scene and write it to a world file, which can then be opened with raycraft <file>.
+	Files ending in .rcwm are written uncompressed so that they can be mapped.
+
+	raycraft --save <scene> <file> [--size N]
+*/
+static int saveScene(int argc, char* argv[])
+{
+	int size = 256;
+	if (argc == 4 && strcmp(argv[2], "--size") == 0) size = atoi(argv[3]);
+
+	if ((argc != 2 && argc != 4) || size < 16) {
+		printf("usage: raycraft --save <scene> <file> [--size N]\n");
+		return 1;
+	}
+
+	rc::world world(size, size, size / 2);
+
+	if (!rc::scenes::build(argv[0], world)) {
+		printf("Unknown scene '%s'!\n", argv[0]);
+		return 1;
+	}
+
+	std::string path = argv[1];
+	bool mappable = path.size() > 5 && path.compare(path.size() - 5, 5, ".rcwm") == 0;
+
+	if (!(mappable ? rc::saveMappableWorld(world, path) : rc::saveWorld(world, path))) {
+		printf("Couldn't write '%s'!\n", argv[1]);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+		return runBenchmark(argc - 2, argv + 2);
+
+	if (argc > 1 && strcmp(argv[1], "--save") == 0)
+		return saveScene(argc - 2, argv + 2);
+
+	// Open the world file given on the command line or create a simple world
+	std::unique_ptr<rc::world> loadedWorld;
+	bool mapped = false;
+
+	if (argc > 1) {
+		// Uncompressed files are mapped privately, so edits don't end up in the file
+		loadedWorld = rc::mapWorld<rc::layout::linear>(argv[1], true);
+		mapped = loadedWorld != nullptr;
+
+		if (!loadedWorld) loadedWorld = rc::loadWorld<rc::layout::linear>(argv[1]);
+
+		if (!loadedWorld) {
+			printf("Couldn't load world '%s'!\n", argv[1]);
+			return 1;
+		}
+	} else {
+		loadedWorld.reset(new rc::world(20, 20, 20));
+		buildDemoWorld(*loadedWorld);
+	}
+
+	rc::world& world = *loadedWorld;
+
+	// Initialize glfw
+	glfwInit();
+
+	// Open window
+	glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
+	glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 3);
+	glfwOpenWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwOpenWindowHint(GLFW_WINDOW_NO_RESIZE, GL_TRUE);
+	glfwOpenWindow(WIDTH, HEIGHT, 0, 0, 0, 0, 0, 0, GLFW_WINDOW);
+	glfwSetWindowTitle("raycraft");
+	glfwSwapInterval(1);
+
+	// Center window on screen
+	GLFWvidmode videoMode;
+	glfwGetDesktopMode(&videoMode);
+	glfwSetWindowPos(videoMode.Width / 2 - WIDTH / 2, videoMode.Height / 2 - HEIGHT / 2);
+
+	// Keep a distance field around to skip through the air faster. Mapped worlds would have to read every
+	// page to build one, and large worlds are rendered through the brick atlas, which doesn't use it.
+	long long volume = (long long) world.sizeX() * world.sizeY() * world.sizeZ();
+	if (!mapped && volume <= MAX_DISTANCE_FIELD_VOLUME)
+		world.buildDistanceField();
 
 	// Create renderer
 	rc::renderer renderer;
 	renderer.setWorld(world);
 
+	// Highlight the block under the cursor from the hit buffer, read back without waiting for the GPU, while clicks are traced on the CPU
+	renderer.setHitBuffer(true);
+
 	// Main loop
 	char titleBuf[128];
 	int frames = 0, curTime = time(nullptr);
@@ -76,6 +316,7 @@ int main()
 		// Handle input
 		int x, y;
 		glfwGetMousePos(&x, &y);
+		renderer.setHighlight(x, y);
 
 		// Allow user to rotate view and destroy blocks
 		if (glfwGetMouseButton(GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
@@ -88,8 +329,8 @@ int main()
 		} else if (lastMouseLeft == GLFW_PRESS) {
 			if (abs(lastMousePos[0] - x) < 2 && abs(lastMousePos[1] - y) < 2) {
 				glm::vec3 pos, normal;
-				renderer.pick(x, y, pos, normal);
-				world.set(pos.x, pos.y, pos.z, rc::material::EMPTY);
+				if (renderer.pick(x, y, pos, normal))
+					world.set(pos.x, pos.y, pos.z, rc::material::EMPTY);
 			}
 
 			lastMouseLeft = 0;
@@ -105,15 +346,17 @@ int main()
 		} else if (lastMouseRight == GLFW_PRESS) {
 			if (abs(lastMousePos[0] - x) < 2 && abs(lastMousePos[1] - y) < 2) {
 				glm::vec3 pos, normal;
-				renderer.pick(x, y, pos, normal);
-				world.set(pos.x + normal.x, pos.y + normal.y, pos.z + normal.z, rc::material::STONE);
+				if (renderer.pick(x, y, pos, normal))
+					world.set(pos.x + normal.x, pos.y + normal.y, pos.z + normal.z, rc::material::STONE);
 			}
 
 			lastMouseRight = 0;
 		}
 
 		// Update view
-		renderer.setCameraTarget(glm::vec3(cos(yaw) * 17.0f + 10.0f, sin(yaw) * 17.0f + 10.0f, 12.0f), glm::vec3(10.0f, 10.0f, 0.0f), 70.0f, (float)WIDTH / (float)HEIGHT);
+		glm::vec3 center(world.sizeX() * 0.5f, world.sizeY() * 0.5f, 0.0f);
+		float radius = std::max(world.sizeX(), world.sizeY()) * 0.85f;
+		renderer.setCameraTarget(glm::vec3(cos(yaw) * radius + center.x, sin(yaw) * radius + center.y, world.sizeZ() * 0.6f), center, 70.0f, (float)WIDTH / (float)HEIGHT);
 
 		// Draw frame
 		renderer.drawFrame();
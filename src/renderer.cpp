@@ -6,7 +6,11 @@
 
 #include <SOIL.h>
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <limits>
+#include <sstream>
 #include <vector>
 
 namespace rc
@@ -21,6 +25,14 @@ namespace rc
 		-1.0f,  1.0f,
 	};
 
+	// Initial size of every staging buffer, larger uploads are split into slabs that fit
+	static const size_t STAGING_SIZE = 4 << 20;
+
+	// Slots per axis of the brick atlas when it's only used because the world is too large for a single texture
+	static const int DEFAULT_ATLAS_SLOTS = 16;
+
+	const int renderer::STAGING_BUFFERS;
+
 	renderer::renderer()
 	{
 		// Load OpenGL functions
@@ -28,8 +40,9 @@ namespace rc
 
 		// Initialize OpenGL
 		initShaders();
+		initState();
 		initVertexData();
-		initPickFramebuffer();
+		initStaging();
 
 		// Load resources
 		loadMaterialTexture();
@@ -39,67 +52,139 @@ namespace rc
 
 		// Block data doesn't exist until world is assigned
 		blockDataTexture = 0;
+		occupancyTexture = 0;
+		distanceTexture = 0;
+		brickTableTexture = 0;
+		brickAtlasTexture = 0;
+		currentWorld = nullptr;
+		atlasSlots = 0;
+		useBrickAtlas = false;
+
+		// Hits are only rendered on request
+		hitFramebuffer = 0;
+		requestedHit.fence = highlightHit.fence = 0;
+		requestedHit.requested = highlightHit.requested = false;
+		setHighlight(-1, -1);
 	}
 
 	renderer::~renderer()
 	{
-		glDeleteTextures(1, &pickColorbuffer);
-		glDeleteFramebuffers(1, &pickFramebuffer);
+		destroyHitBuffer();
 
 		glDeleteTextures(1, &materialsTexture);
 
-		if (blockDataTexture > 0) {
-			glDeleteTextures(1, &blockDataTexture);
-		}
+		// Names of textures that were never created are 0, which is ignored
+		glDeleteTextures(1, &blockDataTexture);
+		glDeleteTextures(1, &occupancyTexture);
+		glDeleteTextures(1, &distanceTexture);
+		glDeleteTextures(1, &brickTableTexture);
+		glDeleteTextures(1, &brickAtlasTexture);
 
+		for (int i = 0; i < STAGING_BUFFERS; i++)
+			if (stagingFences[i] != 0) glDeleteSync(stagingFences[i]);
+		glDeleteBuffers(STAGING_BUFFERS, stagingBuffers);
+
+		glDeleteBuffers(1, &stateBuffer);
 		glDeleteBuffers(1, &vertexBuffer);
 		glDeleteVertexArrays(1, &vertexArray);
-		glDeleteProgram(shaderProgram);
-		glDeleteShader(fragmentShader);
-		glDeleteShader(vertexShader);
+		for (std::map<std::string, GLuint>::iterator it = programs.begin(); it != programs.end(); ++it)
+			glDeleteProgram(it->second);
 	}
 
 	void renderer::setWorld(world& w)
 	{
 		// Clean up previous data
-		if (blockDataTexture > 0) {
-			glDeleteTextures(1, &blockDataTexture);
-		}
+		glDeleteTextures(1, &blockDataTexture);
+		glDeleteTextures(1, &occupancyTexture);
+		glDeleteTextures(1, &distanceTexture);
+		glDeleteTextures(1, &brickTableTexture);
+		glDeleteTextures(1, &brickAtlasTexture);
+
+		blockDataTexture = occupancyTexture = distanceTexture = 0;
+		brickTableTexture = brickAtlasTexture = 0;
+
+		currentWorld = &w;
+		worldCursor = w.generation();
 
-		// Prepare data for shader
-		std::vector<unsigned int> blockData(w.sizeX() * w.sizeY() * w.sizeZ());
-		for (int i = 0; i < w.sizeX() * w.sizeY() * w.sizeZ(); i++)
-			blockData[i] = w.get(i);
-
-		// Upload data as texture
-		glActiveTexture(GL_TEXTURE0);
-		glGenTextures(1, &blockDataTexture);
-		glBindTexture(GL_TEXTURE_3D, blockDataTexture);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexImage3D(GL_TEXTURE_3D, 0, GL_R8UI, w.sizeX(), w.sizeY(), w.sizeZ(), 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &blockData[0]);
-
-		// Enable sampler and pass data to shader
-		glUniform1i(glGetUniformLocation(shaderProgram, "blockData"), 0);
-		glUniform1ui(glGetUniformLocation(shaderProgram, "sx"), w.sizeX());
-		glUniform1ui(glGetUniformLocation(shaderProgram, "sy"), w.sizeY());
-		glUniform1ui(glGetUniformLocation(shaderProgram, "sz"), w.sizeZ());
-
-		// Set iteration limit based on world size
-		int maxIterations = w.sizeX() + w.sizeY() + w.sizeZ();
-		glUniform1i(glGetUniformLocation(shaderProgram, "maxIterations"), maxIterations);
-
-		// Register callback for world updates
-		w.addBlockCallback([] (int x, int y, int z, material::material_t mat)
-		{
+		// Worlds that don't fit in a single texture can only be rendered through the brick atlas
+		GLint maxTextureSize;
+		glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxTextureSize);
+
+		int largestSize = std::max(w.sizeX(), std::max(w.sizeY(), w.sizeZ()));
+		useBrickAtlas = atlasSlots > 0 || largestSize > maxTextureSize;
+
+		if (useBrickAtlas) {
+			int slots = std::min(atlasSlots > 0 ? atlasSlots : DEFAULT_ATLAS_SLOTS, (int) maxTextureSize / world::BRICK_SIZE);
+			atlas.reset(w, slots);
+
+			// Create texture with an entry and the occupancy per brick
+			glActiveTexture(GL_TEXTURE5);
+			glGenTextures(1, &brickTableTexture);
+			glBindTexture(GL_TEXTURE_3D, brickTableTexture);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB32UI, w.bricksX(), w.bricksY(), w.bricksZ(), 0, GL_RGB_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+			// Create texture with the blocks of the resident bricks
+			glActiveTexture(GL_TEXTURE6);
+			glGenTextures(1, &brickAtlasTexture);
+			glBindTexture(GL_TEXTURE_3D, brickAtlasTexture);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+			int atlasSize = slots * world::BRICK_SIZE;
+			glTexImage3D(GL_TEXTURE_3D, 0, GL_R8UI, atlasSize, atlasSize, atlasSize, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+		} else {
+			// Create texture for block data
 			glActiveTexture(GL_TEXTURE0);
-			glTexSubImage3D(GL_TEXTURE_3D, 0, x, y, z, 1, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, &mat);
-		});
+			glGenTextures(1, &blockDataTexture);
+			glBindTexture(GL_TEXTURE_3D, blockDataTexture);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+			// Create texture with the number of empty occupancy levels around every 4x4x4 node
+			glActiveTexture(GL_TEXTURE3);
+			glGenTextures(1, &occupancyTexture);
+			glBindTexture(GL_TEXTURE_3D, occupancyTexture);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexImage3D(GL_TEXTURE_3D, 0, GL_R8UI, (w.sizeX() + 3) / 4, (w.sizeY() + 3) / 4, (w.sizeZ() + 3) / 4, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+
+			// Create texture for the distance field if the world maintains one
+			if (w.hasDistanceField()) {
+				glActiveTexture(GL_TEXTURE4);
+				glGenTextures(1, &distanceTexture);
+				glBindTexture(GL_TEXTURE_3D, distanceTexture);
+				glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+				glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+				glTexImage3D(GL_TEXTURE_3D, 0, GL_R8UI, w.sizeX(), w.sizeY(), w.sizeZ(), 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+			}
+		}
+
+		uploadWorld();
+
+		// The world size and textures in use select the shader variant of the next frame
+	}
+
+	void renderer::setBrickAtlas(int slotsPerAxis)
+	{
+		atlasSlots = slotsPerAxis;
 	}
 
 	void renderer::setSkyColor(const glm::vec3& color)
 	{
-		glUniform4f(glGetUniformLocation(shaderProgram, "skyColor"), color.x, color.y, color.z, 1.0f);
+		state.skyColor = glm::vec4(color, 1.0f);
+		stateChanged = true;
+	}
+
+	void renderer::setShadows(bool enabled)
+	{
+		shadows = enabled;
+	}
+
+	void renderer::setReflections(bool enabled)
+	{
+		reflections = enabled;
 	}
 
 	void renderer::setCameraDir(const glm::vec3& pos, const glm::vec3& dir, float fov, float aspect)
@@ -113,78 +198,197 @@ namespace rc
 		// Luckily for us, it doesn't really matter what farZ we use.
 		glm::mat4 proj = glm::perspective(fov, aspect, 1.0f, 1000.f);
 		glm::mat4 view = glm::lookAt(pos, target, glm::vec3(0.0f, 0.0f, 1.0f));
-		glm::mat4 invProjView = glm::inverse(proj * view);
-		glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "invProjView"), 1, GL_FALSE, glm::value_ptr(invProjView));
-		glUniform3f(glGetUniformLocation(shaderProgram, "viewOrigin"), pos.x, pos.y, pos.z);
+		state.invProjView = glm::inverse(proj * view);
+		state.viewOrigin = pos;
+		stateChanged = true;
 	}
 
-	void renderer::drawFrame() const
+	void renderer::drawFrame()
 	{
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+		syncWorld();
+		useVariant();
+
+		// Update the highlighted block with the latest hit under its pixel
+		if (highlightEnabled) {
+			ray_hit hit;
+			bool found = false;
+
+			if (hitFramebuffer > 0) {
+				found = pollReadback(highlightHit, hit);
+			} else {
+				glm::vec3 pos, normal;
+				hit.hit = pick(highlightHit.x, highlightHit.y, pos, normal);
+				hit.block = glm::ivec3(pos);
+				found = true;
+			}
+
+			if (found) {
+				state.highlightBlock = hit.hit ? hit.block : glm::ivec3(-1);
+				stateChanged = true;
+			}
+		}
+
+		// Upload all state that changed since the last frame at once
+		if (stateChanged) {
+			glBindBuffer(GL_UNIFORM_BUFFER, stateBuffer);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(state), &state);
+			stateChanged = false;
+		}
+
+		if (hitFramebuffer > 0) {
+			// Render color and hits in one pass, then copy the color to the window
+			glBindFramebuffer(GL_FRAMEBUFFER, hitFramebuffer);
+			glDrawArrays(GL_TRIANGLES, 0, 6);
+
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+			glReadBuffer(GL_COLOR_ATTACHMENT0);
+			glBlitFramebuffer(0, 0, hitWidth, hitHeight, 0, 0, hitWidth, hitHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+			if (highlightEnabled && highlightHit.fence == 0) highlightHit.requested = true;
+
+			queueReadback(requestedHit);
+			queueReadback(highlightHit);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		} else {
+			glDrawArrays(GL_TRIANGLES, 0, 6);
+		}
 	}
 
-	void renderer::pick(int x, int y, glm::vec3& pos, glm::vec3& normal) const
+	// Decode a hit written by encodeHit in renderer.frag, the fourth component holds a hit flag, the material and the face
+	static ray_hit decodeHit(const GLuint* hit, float distance)
 	{
-		// Draw scene in picking mode
-		glBindFramebuffer(GL_FRAMEBUFFER, pickFramebuffer);
-		glUniform1ui(glGetUniformLocation(shaderProgram, "pickMode"), GL_TRUE);
+		const glm::ivec3 faces[] = { glm::ivec3(1, 0, 0), glm::ivec3(-1, 0, 0), glm::ivec3(0, 1, 0), glm::ivec3(0, -1, 0), glm::ivec3(0, 0, 1), glm::ivec3(0, 0, -1), glm::ivec3(0) };
 
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+		ray_hit result;
+		result.hit = (hit[3] & 0x10000) != 0;
+		result.block = glm::ivec3(hit[0], hit[1], hit[2]);
+		result.normal = faces[std::min(hit[3] & 0xff, 6u)];
+		result.distance = distance;
+		result.mat = material::material_t((hit[3] >> 8) & 0xff);
+
+		return result;
+	}
+
+	bool renderer::pick(int x, int y, glm::vec3& pos, glm::vec3& normal) const
+	{
+		if (currentWorld == nullptr) return false;
 
-		// Read position and normal from selected pixel in window coordinates (y-flipped)
+		// Unproject the center of the pixel, window coordinates start at the top
 		GLint viewport[4];
 		glGetIntegerv(GL_VIEWPORT, viewport);
 
-		GLubyte pixel[4];
-		glReadPixels(x, viewport[3] - y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+		glm::vec2 coord((x + 0.5f) / viewport[2] * 2.0f - 1.0f, 1.0f - (y + 0.5f) / viewport[3] * 2.0f);
+		glm::vec4 dir = state.invProjView * glm::vec4(coord, 1.0f, 1.0f);
 
-		pos = glm::vec3(pixel[0], pixel[1], pixel[2]);
+		// Trace the ray through the blocks on the CPU, reading the hit buffer back here would wait for the GPU
+		ray_hit hit = currentWorld->raycast(state.viewOrigin, glm::vec3(dir), std::numeric_limits<float>::infinity());
 
-		switch (pixel[3]) {
-			case 0: normal = glm::vec3(1, 0, 0); break;
-			case 1: normal = glm::vec3(-1, 0, 0); break;
-			case 2: normal = glm::vec3(0, 1, 0); break;
-			case 3: normal = glm::vec3(0, -1, 0); break;
-			case 4: normal = glm::vec3(0, 0, 1); break;
-			case 5: normal = glm::vec3(0, 0, -1); break;
-		}
+		if (!hit.hit) return false;
 
-		// Return to normal rendering mode
-		glUniform1ui(glGetUniformLocation(shaderProgram, "pickMode"), GL_FALSE);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		pos = glm::vec3(hit.block);
+		normal = glm::vec3(hit.normal);
+
+		return true;
+	}
+
+	void renderer::setHitBuffer(bool enabled)
+	{
+		destroyHitBuffer();
+		if (enabled) initHitBuffer();
+	}
+
+	void renderer::requestHit(int x, int y)
+	{
+		requestedHit.x = x;
+		requestedHit.y = y;
+		requestedHit.requested = true;
+	}
+
+	bool renderer::pollHit(ray_hit& result)
+	{
+		return pollReadback(requestedHit, result);
+	}
+
+	void renderer::setHighlight(int x, int y)
+	{
+		highlightEnabled = x >= 0 && y >= 0;
+		highlightHit.x = x;
+		highlightHit.y = y;
+
+		if (!highlightEnabled) {
+			state.highlightBlock = glm::ivec3(-1);
+			stateChanged = true;
+		}
 	}
 
 	void renderer::initShaders()
 	{
-		vertexShader = loadShader("renderer.vert", GL_VERTEX_SHADER);
-		fragmentShader = loadShader("renderer.frag", GL_FRAGMENT_SHADER);
+		// Variants are compiled from these when they're first used
+		vertexSource = loadShaderSource("renderer.vert");
+		fragmentSource = loadShaderSource("renderer.frag");
 
-		shaderProgram = glCreateProgram();
-		glAttachShader(shaderProgram, vertexShader);
-		glAttachShader(shaderProgram, fragmentShader);
-		glLinkProgram(shaderProgram);
-		glUseProgram(shaderProgram);
+		// Cached program binaries are only valid for the driver that created them
+		const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+
+		for (int i = 0; i < 3; i++) {
+			const GLubyte* str = glGetString(driverStrings[i]);
+			if (str != nullptr) driverVersion += std::string((const char*) str) + "\n";
+		}
+
+		shaderProgram = 0;
+		shadows = true;
+		reflections = true;
+		materialCount = 1;
+	}
+
+	void renderer::initState()
+	{
+		state = render_state();
+		state.highlightBlock = glm::ivec3(-1);
+
+		// Per-frame state is passed to every variant through a single uniform buffer on binding point 0
+		glGenBuffers(1, &stateBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, stateBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(state), nullptr, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, 0, stateBuffer);
+
+		stateChanged = true;
 	}
 
-	GLuint renderer::loadShader(const std::string& path, GLenum type)
+	std::string renderer::loadShaderSource(const std::string& path)
 	{
-		// Locate shader file and read it
+		// Locate shader file and read it, cached programs are stored next to it
 		std::ifstream file(path.c_str(), std::ios::ate);
-		if (!file.is_open()) file.open(("bin/" + path).c_str(), std::ios::in | std::ios::ate);
+		shaderDirectory = "";
+
+		if (!file.is_open()) {
+			file.open(("bin/" + path).c_str(), std::ios::in | std::ios::ate);
+			shaderDirectory = "bin/";
+		}
 
 		if (!file.is_open() || (int)file.tellg() == 0) {
 			printf("Couldn't load shader file '%s'!\n", path.c_str());
-			return 0;
+			return std::string();
 		}
 
 		int len = (int)file.tellg();
 		file.seekg(0, std::ios::beg);
 
-		std::vector<char> src(len);
-		char* srcPtr = &src[0];
+		std::string src(len, '\0');
 		file.read(&src[0], len);
 
-		file.close();
+		return src;
+	}
+
+	GLuint renderer::compileShader(const std::string& source, const std::string& defines, GLenum type)
+	{
+		// Defines have to follow the #version line
+		size_t versionEnd = source.find('\n') + 1;
+		std::string src = source.substr(0, versionEnd) + defines + source.substr(versionEnd);
+
+		const char* srcPtr = src.c_str();
+		int len = (int)src.size();
 
 		// Create and compile shader
 		GLuint shader = glCreateShader(type);
@@ -195,15 +399,208 @@ namespace rc
 		int status;
 		glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
 		if (status == GL_FALSE) {
-			char buf[512];
-			GLsizei length;
-			glGetShaderInfoLog(shader, 512, &length, buf);
-			printf("%s\n", buf);
+			int length;
+			glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+
+			std::vector<char> log(std::max(length, 1));
+			glGetShaderInfoLog(shader, (GLsizei) log.size(), nullptr, &log[0]);
+			printf("Couldn't compile %s shader with defines:\n%s%s\n", type == GL_VERTEX_SHADER ? "vertex" : "fragment", defines.c_str(), &log[0]);
 		}
 
 		return shader;
 	}
 
+	std::string renderer::variantDefines() const
+	{
+		std::ostringstream defines;
+
+		glm::ivec3 size = currentWorld != nullptr ? glm::ivec3(currentWorld->sizeX(), currentWorld->sizeY(), currentWorld->sizeZ()) : glm::ivec3(0);
+		defines << "#define WORLD_SIZE ivec3(" << size.x << ", " << size.y << ", " << size.z << ")\n";
+		defines << "#define MATERIAL_COUNT " << materialCount << ".0\n";
+
+		if (distanceTexture > 0) defines << "#define USE_DISTANCE_FIELD\n";
+		if (useBrickAtlas) defines << "#define USE_BRICK_ATLAS\n#define ATLAS_SLOTS " << atlas.slotsPerAxis() << "\n";
+		if (hitFramebuffer > 0) defines << "#define HIT_BUFFER\n";
+		if (shadows) defines << "#define SHADOWS\n";
+		if (reflections) defines << "#define REFLECTIONS\n";
+
+		return defines.str();
+	}
+
+	// 64-bit FNV-1a hash
+	static uint64_t hashString(const std::string& str)
+	{
+		uint64_t hash = 14695981039346656037ull;
+
+		for (size_t i = 0; i < str.size(); i++) {
+			hash ^= (unsigned char) str[i];
+			hash *= 1099511628211ull;
+		}
+
+		return hash;
+	}
+
+	// Program binaries need GL 4.1 or ARB_get_program_binary and a driver that has at least one format
+	static bool supportsProgramBinaries()
+	{
+		if (glProgramParameteri == nullptr || glProgramBinary == nullptr || glGetProgramBinary == nullptr) return false;
+
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+		return formats > 0;
+	}
+
+	GLuint renderer::buildProgram(const std::string& defines)
+	{
+		// Without program binaries the cache does nothing and every program is compiled
+		bool cached = supportsProgramBinaries();
+
+		// Try the binary of an earlier launch with the same sources, defines and driver first
+		std::string key = driverVersion + defines + vertexSource + fragmentSource;
+
+		char name[64];
+		sprintf(name, "shader_cache_%016llx.bin", (unsigned long long) hashString(key));
+		std::string cachePath = shaderDirectory + name;
+
+		GLuint program = cached ? loadProgramBinary(cachePath, key) : 0;
+
+		if (program == 0) {
+			GLuint vertexShader = compileShader(vertexSource, defines, GL_VERTEX_SHADER);
+			GLuint fragmentShader = compileShader(fragmentSource, defines, GL_FRAGMENT_SHADER);
+
+			program = glCreateProgram();
+			glAttachShader(program, vertexShader);
+			glAttachShader(program, fragmentShader);
+			if (cached) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			glLinkProgram(program);
+
+			// The program keeps the compiled code
+			glDetachShader(program, vertexShader);
+			glDetachShader(program, fragmentShader);
+			glDeleteShader(vertexShader);
+			glDeleteShader(fragmentShader);
+
+			if (checkProgram(program, defines) && cached)
+				saveProgramBinary(program, cachePath, key);
+		}
+
+		glUseProgram(program);
+
+		// Samplers always use the same texture units
+		glUniform1i(glGetUniformLocation(program, "blockData"), 0);
+		glUniform1i(glGetUniformLocation(program, "materials"), 1);
+		glUniform1i(glGetUniformLocation(program, "emptyLevels"), 3);
+		glUniform1i(glGetUniformLocation(program, "distanceField"), 4);
+		glUniform1i(glGetUniformLocation(program, "brickTable"), 5);
+		glUniform1i(glGetUniformLocation(program, "brickAtlas"), 6);
+
+		glUniformBlockBinding(program, glGetUniformBlockIndex(program, "renderState"), 0);
+
+		return program;
+	}
+
+	bool renderer::checkProgram(GLuint program, const std::string& defines)
+	{
+		int status;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (status == GL_TRUE) return true;
+
+		int length;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+
+		std::vector<char> log(std::max(length, 1));
+		glGetProgramInfoLog(program, (GLsizei) log.size(), nullptr, &log[0]);
+		printf("Couldn't link shader program with defines:\n%s%s\n", defines.c_str(), &log[0]);
+
+		return false;
+	}
+
+	GLuint renderer::loadProgramBinary(const std::string& path, const std::string& key)
+	{
+		if (glProgramBinary == nullptr) return 0;
+
+		std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+		if (!file.is_open()) return 0;
+
+		// The file starts with the full key, which rules out hash collisions
+		uint32_t keyLength = 0;
+		file.read((char*) &keyLength, sizeof(keyLength));
+		if (!file || keyLength != key.size()) return 0;
+
+		std::string storedKey(keyLength, '\0');
+		file.read(&storedKey[0], keyLength);
+		if (!file || storedKey != key) return 0;
+
+		GLenum format;
+		uint32_t length = 0;
+		file.read((char*) &format, sizeof(format));
+		file.read((char*) &length, sizeof(length));
+		if (!file || length == 0) return 0;
+
+		std::vector<char> binary(length);
+		file.read(&binary[0], length);
+		if (!file) return 0;
+
+		// The driver may still reject it, for example after an update that didn't change its version string
+		GLuint program = glCreateProgram();
+		glProgramBinary(program, format, &binary[0], (GLsizei) length);
+
+		int status;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+
+		if (status == GL_FALSE) {
+			glDeleteProgram(program);
+			return 0;
+		}
+
+		return program;
+	}
+
+	void renderer::saveProgramBinary(GLuint program, const std::string& path, const std::string& key)
+	{
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		if (glGetProgramBinary == nullptr || formats == 0) return;
+
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length == 0) return;
+
+		std::vector<char> binary(length);
+		GLenum format;
+		glGetProgramBinary(program, length, nullptr, &format, &binary[0]);
+
+		std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) return;
+
+		uint32_t keyLength = (uint32_t) key.size();
+		uint32_t binaryLength = (uint32_t) length;
+
+		file.write((const char*) &keyLength, sizeof(keyLength));
+		file.write(key.data(), keyLength);
+		file.write((const char*) &format, sizeof(format));
+		file.write((const char*) &binaryLength, sizeof(binaryLength));
+		file.write(&binary[0], length);
+	}
+
+	void renderer::useVariant()
+	{
+		std::string defines = variantDefines();
+		if (shaderProgram > 0 && defines == programDefines) return;
+
+		// Every combination is only built once
+		std::map<std::string, GLuint>::iterator it = programs.find(defines);
+
+		if (it == programs.end())
+			it = programs.insert(std::make_pair(defines, buildProgram(defines))).first;
+
+		shaderProgram = it->second;
+		programDefines = defines;
+
+		glUseProgram(shaderProgram);
+	}
+
 	void renderer::initVertexData()
 	{
 		// Load vertex data
@@ -219,29 +616,151 @@ namespace rc
 		glEnableVertexAttribArray(0);
 	}
 
-	void renderer::initPickFramebuffer()
+	void renderer::initStaging()
 	{
-		// Create frame buffer to hold picking result
-		glGenFramebuffers(1, &pickFramebuffer);
-		glBindFramebuffer(GL_FRAMEBUFFER, pickFramebuffer);
+		glGenBuffers(STAGING_BUFFERS, stagingBuffers);
 
-		// Create texture to hold color buffer
-		glGenTextures(1, &pickColorbuffer);
+		for (int i = 0; i < STAGING_BUFFERS; i++) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffers[i]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, STAGING_SIZE, nullptr, GL_STREAM_DRAW);
 
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, pickColorbuffer);
+			stagingFences[i] = 0;
+			stagingSizes[i] = STAGING_SIZE;
+		}
 
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		stagingIndex = 0;
+	}
+
+	void renderer::initHitBuffer()
+	{
 		GLint viewport[4];
 		glGetIntegerv(GL_VIEWPORT, viewport);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, viewport[2], viewport[3], 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		hitWidth = viewport[2];
+		hitHeight = viewport[3];
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		// Create frame buffer with the color and the hit of every pixel
+		glGenFramebuffers(1, &hitFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, hitFramebuffer);
 
-		// Attach color buffer
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pickColorbuffer, 0);
+		glActiveTexture(GL_TEXTURE2);
+
+		glGenTextures(1, &hitColorbuffer);
+		glBindTexture(GL_TEXTURE_2D, hitColorbuffer);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, hitWidth, hitHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		// Integer coordinates cover every world size
+		glGenTextures(1, &hitBuffer);
+		glBindTexture(GL_TEXTURE_2D, hitBuffer);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, hitWidth, hitHeight, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		// Distance along the primary ray
+		glGenTextures(1, &hitDepthBuffer);
+		glBindTexture(GL_TEXTURE_2D, hitDepthBuffer);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, hitWidth, hitHeight, 0, GL_RED, GL_FLOAT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hitColorbuffer, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, hitBuffer, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, hitDepthBuffer, 0);
+
+		const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+		glDrawBuffers(3, drawBuffers);
 
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		// Pixel buffers that hits are copied into, with the distance after the hit
+		hit_readback* readbacks[] = { &requestedHit, &highlightHit };
+
+		for (int i = 0; i < 2; i++) {
+			glGenBuffers(1, &readbacks[i]->pixelBuffer);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, readbacks[i]->pixelBuffer);
+			glBufferData(GL_PIXEL_PACK_BUFFER, 4 * sizeof(GLuint) + sizeof(float), nullptr, GL_STREAM_READ);
+
+			readbacks[i]->fence = 0;
+			readbacks[i]->requested = false;
+		}
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	void renderer::destroyHitBuffer()
+	{
+		if (hitFramebuffer == 0) return;
+
+		hit_readback* readbacks[] = { &requestedHit, &highlightHit };
+
+		for (int i = 0; i < 2; i++) {
+			if (readbacks[i]->fence != 0) glDeleteSync(readbacks[i]->fence);
+			glDeleteBuffers(1, &readbacks[i]->pixelBuffer);
+
+			readbacks[i]->fence = 0;
+			readbacks[i]->requested = false;
+		}
+
+		glDeleteTextures(1, &hitDepthBuffer);
+		glDeleteTextures(1, &hitBuffer);
+		glDeleteTextures(1, &hitColorbuffer);
+		glDeleteFramebuffers(1, &hitFramebuffer);
+
+		hitFramebuffer = 0;
+	}
+
+	void renderer::queueReadback(hit_readback& readback)
+	{
+		if (!readback.requested) return;
+		readback.requested = false;
+
+		if (readback.x < 0 || readback.y < 0 || readback.x >= hitWidth || readback.y >= hitHeight) return;
+
+		// Queue the copy of the pixel (y-flipped) into the pixel buffer, the fence tells when it's done
+		int y = hitHeight - 1 - readback.y;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pixelBuffer);
+		glReadBuffer(GL_COLOR_ATTACHMENT1);
+		glReadPixels(readback.x, y, 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_INT, 0);
+		glReadBuffer(GL_COLOR_ATTACHMENT2);
+		glReadPixels(readback.x, y, 1, 1, GL_RED, GL_FLOAT, (void*) (4 * sizeof(GLuint)));
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		if (readback.fence != 0) glDeleteSync(readback.fence);
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	bool renderer::pollReadback(hit_readback& readback, ray_hit& result)
+	{
+		if (hitFramebuffer == 0 || readback.fence == 0) return false;
+
+		// Check if the copy into the pixel buffer has finished without blocking
+		GLenum status = glClientWaitSync(readback.fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED) return false;
+
+		glDeleteSync(readback.fence);
+		readback.fence = 0;
+
+		if (status == GL_WAIT_FAILED) return false;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pixelBuffer);
+		const GLuint* hit = (const GLuint*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 4 * sizeof(GLuint) + sizeof(float), GL_MAP_READ_BIT);
+
+		if (hit == nullptr) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			return false;
+		}
+
+		float distance;
+		memcpy(&distance, hit + 4, sizeof(float));
+		result = decodeHit(hit, distance);
+
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		return true;
 	}
 
 	void renderer::loadMaterialTexture()
@@ -265,9 +784,251 @@ namespace rc
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-		glUniform1i(glGetUniformLocation(shaderProgram, "materials"), 1);
-		glUniform1f(glGetUniformLocation(shaderProgram, "materialCount"), 7);
+		// Materials are columns of square tiles for the four kinds of faces
+		materialCount = 4 * w / h;
 
 		SOIL_free_image_data(pixels);
 	}
-}
\ No newline at end of file
+
+	// Nodes of the occupancy texture that a change to a region of blocks can affect
+	static box occupancyNodes(const world& w, const box& region)
+	{
+		// A change can affect every level up to the 64x64x64 node around it, which holds 16x16x16 nodes of 4x4x4
+		glm::ivec3 nodeCount((w.sizeX() + 3) / 4, (w.sizeY() + 3) / 4, (w.sizeZ() + 3) / 4);
+		return box((region.min / 64) * 16, glm::min(((region.max + 63) / 64) * 16, nodeCount));
+	}
+
+	// Blocks of the distance field that a change to a region of blocks can affect
+	static box distanceRegion(const world& w, const box& region)
+	{
+		box worldBox(glm::ivec3(0, 0, 0), glm::ivec3(w.sizeX(), w.sizeY(), w.sizeZ()));
+		return box(region.min - world::DISTANCE_LIMIT, region.max + world::DISTANCE_LIMIT).clipped(worldBox);
+	}
+
+	void renderer::uploadWorld()
+	{
+		world& w = *currentWorld;
+		std::vector<texture_upload> uploads;
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		if (useBrickAtlas) {
+			// Start over with every brick and load the ones around the camera
+			atlas.reset(w, atlas.slotsPerAxis());
+			atlas.update(w, state.viewOrigin);
+			queueAtlasUploads(uploads);
+		} else {
+			// Allocate the texture and fill it slab by slab straight from the bricks, block rows are tightly packed
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_3D, blockDataTexture);
+			glTexImage3D(GL_TEXTURE_3D, 0, GL_R8UI, w.sizeX(), w.sizeY(), w.sizeZ(), 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+
+			box worldBox(glm::ivec3(0, 0, 0), glm::ivec3(w.sizeX(), w.sizeY(), w.sizeZ()));
+
+			uploads.push_back(texture_upload(BLOCK_DATA, worldBox));
+			uploads.push_back(texture_upload(OCCUPANCY, occupancyNodes(w, worldBox)));
+			if (distanceTexture > 0) uploads.push_back(texture_upload(DISTANCES, worldBox));
+		}
+
+		uploadTextures(uploads);
+	}
+
+	void renderer::syncWorld()
+	{
+		if (currentWorld == nullptr) return;
+
+		// Pull the regions that changed since the last frame
+		std::vector<box> regions;
+
+		if (!currentWorld->pollChanges(worldCursor, regions)) {
+			uploadWorld();
+			return;
+		}
+
+		std::vector<texture_upload> uploads;
+
+		if (useBrickAtlas) {
+			// Bricks are streamed in as the camera moves, even if nothing changed
+			for (int i = 0; i < regions.size(); i++)
+				atlas.invalidate(*currentWorld, regions[i]);
+
+			atlas.update(*currentWorld, state.viewOrigin);
+			queueAtlasUploads(uploads);
+		} else {
+			// Nearby changes often affect the same occupancy nodes and distances, so coalesce those per texture
+			std::vector<box> nodes, distances;
+
+			for (int i = 0; i < regions.size(); i++) {
+				mergeRegion(nodes, occupancyNodes(*currentWorld, regions[i]));
+				if (distanceTexture > 0) mergeRegion(distances, distanceRegion(*currentWorld, regions[i]));
+			}
+
+			for (int i = 0; i < regions.size(); i++) uploads.push_back(texture_upload(BLOCK_DATA, regions[i]));
+			for (int i = 0; i < nodes.size(); i++) uploads.push_back(texture_upload(OCCUPANCY, nodes[i]));
+			for (int i = 0; i < distances.size(); i++) uploads.push_back(texture_upload(DISTANCES, distances[i]));
+		}
+
+		if (!uploads.empty()) uploadTextures(uploads);
+	}
+
+	void renderer::queueAtlasUploads(std::vector<texture_upload>& uploads)
+	{
+		const std::vector<box>& entries = atlas.changedEntries();
+		const std::vector<int>& slots = atlas.loadedSlots();
+
+		for (int i = 0; i < entries.size(); i++)
+			uploads.push_back(texture_upload(BRICK_TABLE, entries[i]));
+
+		// Slots that were freed again in the meantime are skipped
+		for (int i = 0; i < slots.size(); i++) {
+			if (atlas.slotBrick(slots[i]).x < 0) continue;
+
+			glm::ivec3 origin = atlas.slotOrigin(slots[i]);
+			uploads.push_back(texture_upload(BRICK_ATLAS, box(origin, origin + world::BRICK_SIZE)));
+		}
+
+		atlas.clearChanges();
+	}
+
+	void renderer::uploadTextures(const std::vector<texture_upload>& uploads)
+	{
+		std::vector<texture_upload> pending;
+		size_t used = 0;
+
+		for (int i = 0; i < uploads.size(); i++) {
+			const box& r = uploads[i].region;
+			if (r.empty()) continue;
+
+			// Split regions into slabs of whole z slices that fit in a staging buffer
+			size_t sliceSize = size_t(r.max.x - r.min.x) * (r.max.y - r.min.y) * texelSize(uploads[i].target);
+			int slabDepth = (int) std::max<size_t>(1, STAGING_SIZE / sliceSize);
+
+			for (int z = r.min.z; z < r.max.z; z += slabDepth) {
+				texture_upload slab(uploads[i].target, box(glm::ivec3(r.min.x, r.min.y, z), glm::ivec3(r.max.x, r.max.y, std::min(r.max.z, z + slabDepth))));
+				size_t size = (size_t) slab.region.volume() * texelSize(slab.target);
+
+				// Offsets in the buffer have to be a multiple of the texel size
+				used = (used + 3) & ~size_t(3);
+
+				if (!pending.empty() && used + size > stagingSizes[stagingIndex]) {
+					flushStaging(pending);
+					used = 0;
+				}
+
+				if (pending.empty()) {
+					// Wait until the GPU has finished the uploads that last used this buffer, which were issued frames ago
+					GLsync& fence = stagingFences[stagingIndex];
+
+					if (fence != 0) {
+						glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(-1));
+						glDeleteSync(fence);
+						fence = 0;
+					}
+
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffers[stagingIndex]);
+
+					// Only a single slice can be larger than the default size
+					if (size > stagingSizes[stagingIndex]) {
+						glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+						stagingSizes[stagingIndex] = size;
+					}
+				}
+
+				slab.offset = used;
+				used += size;
+				pending.push_back(slab);
+			}
+		}
+
+		if (!pending.empty()) flushStaging(pending);
+	}
+
+	void renderer::flushStaging(std::vector<texture_upload>& pending)
+	{
+		// The fence guarantees that the buffer is no longer read, so it can be written without synchronization
+		size_t size = pending.back().offset + (size_t) pending.back().region.volume() * texelSize(pending.back().target);
+		uint8_t* data = (uint8_t*) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+		// The world cursor has already moved past these changes, so if the buffer can't be mapped they're uploaded
+		// from client memory instead of being dropped
+		std::vector<uint8_t> fallback;
+
+		if (data != nullptr) {
+			for (int i = 0; i < pending.size(); i++)
+				copyTexels(pending[i].target, pending[i].region, data + pending[i].offset);
+
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		} else {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			fallback.resize(size);
+
+			for (int i = 0; i < pending.size(); i++)
+				copyTexels(pending[i].target, pending[i].region, &fallback[pending[i].offset]);
+		}
+
+		// Textures are bound explicitly, because uploads can happen while any texture unit is active
+		const GLuint textures[] = { blockDataTexture, occupancyTexture, distanceTexture, brickTableTexture, brickAtlasTexture };
+		const GLenum units[] = { GL_TEXTURE0, GL_TEXTURE3, GL_TEXTURE4, GL_TEXTURE5, GL_TEXTURE6 };
+
+		for (int i = 0; i < pending.size(); i++) {
+			const box& r = pending[i].region;
+			glm::ivec3 size = r.max - r.min;
+			GLenum format = pending[i].target == BRICK_TABLE ? GL_RGB_INTEGER : GL_RED_INTEGER;
+			GLenum type = pending[i].target == BRICK_TABLE ? GL_UNSIGNED_INT : GL_UNSIGNED_BYTE;
+			const void* pixels = data != nullptr ? (const void*) pending[i].offset : (const void*) &fallback[pending[i].offset];
+
+			glActiveTexture(units[pending[i].target]);
+			glBindTexture(GL_TEXTURE_3D, textures[pending[i].target]);
+			glTexSubImage3D(GL_TEXTURE_3D, 0, r.min.x, r.min.y, r.min.z, size.x, size.y, size.z, format, type, pixels);
+		}
+
+		if (data != nullptr) stagingFences[stagingIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		stagingIndex = (stagingIndex + 1) % STAGING_BUFFERS;
+		pending.clear();
+	}
+
+	void renderer::copyTexels(upload_target target, const box& region, uint8_t* out) const
+	{
+		const world& w = *currentWorld;
+
+		if (target == BLOCK_DATA) {
+			w.copyRegion(region, out);
+		} else if (target == DISTANCES) {
+			w.copyDistanceRegion(region, out);
+		} else if (target == BRICK_TABLE) {
+			const std::vector<uint32_t>& table = atlas.table();
+			uint32_t* texels = (uint32_t*) out;
+
+			for (int z = region.min.z; z < region.max.z; z++) {
+				for (int y = region.min.y; y < region.max.y; y++) {
+					for (int x = region.min.x; x < region.max.x; x++) {
+						uint64_t occupancy = w.brickOccupancy(x, y, z);
+
+						*texels++ = table[(z * w.bricksY() + y) * w.bricksX() + x];
+						*texels++ = uint32_t(occupancy);
+						*texels++ = uint32_t(occupancy >> 32);
+					}
+				}
+			}
+		} else if (target == BRICK_ATLAS) {
+			// Expanded bricks of a world with linear layout are already in x, y, z order
+			int slots = atlas.slotsPerAxis();
+			glm::ivec3 slot = region.min / world::BRICK_SIZE;
+			glm::ivec3 b = atlas.slotBrick((slot.z * slots + slot.y) * slots + slot.x);
+			block_span blocks = w.brickData(b.x, b.y, b.z);
+
+			if (blocks.empty())
+				memset(out, w.brickMaterial(b.x, b.y, b.z), world::BRICK_VOLUME);
+			else
+				memcpy(out, blocks.data(), blocks.sizeBytes());
+		} else {
+			for (int z = region.min.z; z < region.max.z; z++)
+				for (int y = region.min.y; y < region.max.y; y++)
+					for (int x = region.min.x; x < region.max.x; x++)
+						*out++ = w.emptyLevels(x * 4, y * 4, z * 4);
+		}
+	}
+}
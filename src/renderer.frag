@@ -1,22 +1,38 @@
 #version 330
 
+// Every variant is compiled with these defined by the renderer, see renderer::variantDefines:
+//   WORLD_SIZE, MATERIAL_COUNT     world dimensions and number of materials in the texture
+//   USE_DISTANCE_FIELD             skip empty space with the distance field
+//   USE_BRICK_ATLAS, ATLAS_SLOTS   read blocks through the brick table and atlas
+//   HIT_BUFFER                     also write the primary hits
+//   SHADOWS, REFLECTIONS           trace rays towards the light and off gold blocks
+
 layout(location = 0) out vec4 outColor;
+#ifdef HIT_BUFFER
+layout(location = 1) out uvec4 outHit;
+layout(location = 2) out float outDepth;
+#endif
 in vec2 _position;
 
-// Mode
-uniform bool pickMode;
+// State that changes per frame, updated at once from renderer::render_state
+layout(std140) uniform renderState
+{
+	mat4 invProjView;
+	vec3 viewOrigin;
+	vec4 skyColor;
+	ivec3 highlightBlock;
+};
 
-// View info
-uniform vec3 viewOrigin;
-uniform mat4 invProjView;
+// A ray crosses at most this many blocks
+const int maxIterations = WORLD_SIZE.x + WORLD_SIZE.y + WORLD_SIZE.z;
 
-// World info
+// World data
 uniform usampler3D blockData;
+uniform usampler3D emptyLevels;
+uniform usampler3D distanceField;
+uniform usampler3D brickTable;
+uniform usampler3D brickAtlas;
 uniform sampler2D materials;
-uniform float materialCount;
-uniform uint sx, sy, sz;
-uniform vec4 skyColor;
-uniform int maxIterations;
 
 // Project screen space vector in object space
 vec3 unproject(vec2 coord)
@@ -25,93 +41,91 @@ vec3 unproject(vec2 coord)
 	return normalize(v.xyz);
 }
 
+// Entries of the brick table, see brick_atlas
+const uint UNIFORM_BIT = 0x80000000u;
+const uint EMPTY_REGION_BIT = 0x40000000u;
+const uint PROXY_BIT = 0x20000000u;
+
+#ifdef USE_BRICK_ATLAS
+// Whether the 4x4x4 node containing a block is solid in the occupancy mask of its brick
+bool nodeOccupied(uvec3 entry, ivec3 coords)
+{
+	ivec3 node = (coords >> 2) & 3;
+	int bit = (node.z << 4) | (node.y << 2) | node.x;
+
+	return ((bit < 32 ? entry.y >> bit : entry.z >> (bit - 32)) & 1u) != 0u;
+}
+#endif
+
 // Get the material of the block at the specified position in the world
 int getBlock(ivec3 coords)
 {
+#ifdef USE_BRICK_ATLAS
+	uvec3 entry = texelFetch(brickTable, coords >> 4, 0).xyz;
+
+	// Bricks that aren't resident are drawn at the resolution of their occupancy
+	if ((entry.x & PROXY_BIT) != 0u) return nodeOccupied(entry, coords) ? int(entry.x & 0xffu) : 0;
+	if ((entry.x & UNIFORM_BIT) != 0u) return int(entry.x & 0xffu);
+
+	// Otherwise the entry is the index of the slot in the atlas that holds the brick
+	int slot = int(entry.x);
+	ivec3 slotOrigin = ivec3(slot % ATLAS_SLOTS, (slot / ATLAS_SLOTS) % ATLAS_SLOTS, slot / (ATLAS_SLOTS * ATLAS_SLOTS)) * 16;
+
+	return int(texelFetch(brickAtlas, slotOrigin + (coords & 15), 0).x);
+#else
 	return int(texelFetch(blockData, coords, 0).x);
+#endif
 }
 
-// Convert floating point position to block coordinates
-// The raytracing direction is used for correction
-ivec3 toBlock(vec3 pos, vec3 dir)
+// Get the number of occupancy pyramid levels that are empty around the 4x4x4 node containing a block
+int getEmptyLevels(ivec3 coords)
 {
-	if ((dir.x < 0.0 && pos.x < 0.001) || (dir.y < 0.0 && pos.y < 0.001) || (dir.z < 0.0 && pos.z < 0.001))
-		return ivec3(-1, -1, -1);
-	else
-		return ivec3(int(pos.x), int(pos.y), int(pos.z));
+#ifdef USE_BRICK_ATLAS
+	// The brick table knows about empty 64x64x64 regions, empty bricks and the empty nodes of expanded bricks
+	uvec3 entry = texelFetch(brickTable, coords >> 4, 0).xyz;
+
+	if (entry.x == (UNIFORM_BIT | EMPTY_REGION_BIT)) return 3;
+	if (entry.x == UNIFORM_BIT) return 2;
+	if ((entry.x & UNIFORM_BIT) != 0u && (entry.x & PROXY_BIT) == 0u) return 0;
+
+	return nodeOccupied(entry, coords) ? 0 : 1;
+#else
+	return int(texelFetch(emptyLevels, coords >> 2, 0).x);
+#endif
 }
 
-// Find the position where a line and an infinite plane intersect each other
-vec3 rayPlaneIntersect(vec3 linePos, vec3 lineDir, vec3 planePos, vec3 planeNormal)
+// Get the Chebyshev distance from a block to the nearest solid block
+int getDistance(ivec3 coords)
 {
-	float d = dot((planePos - linePos), planeNormal) / dot(lineDir, planeNormal);
-	if (d > 0.0)
-		return linePos + d * lineDir;
-	else
-		return vec3(1.0 / 0.0);
+	return int(texelFetch(distanceField, coords, 0).x);
 }
 
-// Find the position where a line and a cube intersect each other
-bool rayCube(vec3 origin, vec3 dir, vec3 pos, vec3 size, out vec3 hitPos, out vec3 hitNormal)
+// Find where a ray enters a box and the normal of the face it enters through
+bool rayBox(vec3 origin, vec3 dir, vec3 boxMin, vec3 boxMax, out float tEnter, out vec3 normal)
 {
-	// Transform world so that cube is located at (0, 0, 0) to simplify math
-	origin -= pos;
-
-	float dist = 1.0 / 0.0;
-	vec3 temp, final, norm;
-
-	// Bottom
-	temp = rayPlaneIntersect(origin, dir, vec3(0, 0, 0), vec3(0, 0, 1));
-	if (temp.x > 0.0 && temp.x < size.x && temp.y > 0.0 && temp.y < size.y && distance(origin, temp) < dist) {
-		dist = distance(origin, temp);
-		final = temp;
-		norm = vec3(0, 0, -1);
-	}
-
-	// Top
-	temp = rayPlaneIntersect(origin, dir, vec3(0, 0, size.z), vec3(0, 0, 1));
-	if (temp.x > 0.0 && temp.x < size.x && temp.y > 0.0 && temp.y < size.y && distance(origin, temp) < dist) {
-		dist = distance(origin, temp);
-		final = temp;
-		norm = vec3(0, 0, 1);
-	}
-
-	// Left
-	temp = rayPlaneIntersect(origin, dir, vec3(0, 0, 0), vec3(-1, 0, 0));
-	if (temp.y > 0.0 && temp.y < size.y && temp.z > 0.0 && temp.z < size.z && distance(origin, temp) < dist) {
-		dist = distance(origin, temp);
-		final = temp;
-		norm = vec3(-1, 0, 0);
-	}
-
-	// Right
-	temp = rayPlaneIntersect(origin, dir, vec3(size.x, 0, 0), vec3(1, 0, 0));
-	if (temp.y > 0.0 && temp.y < size.y && temp.z > 0.0 && temp.z < size.z && distance(origin, temp) < dist) {
-		dist = distance(origin, temp);
-		final = temp;
-		norm = vec3(1, 0, 0);
-	}
-
-	// Rear
-	temp = rayPlaneIntersect(origin, dir, vec3(0, 0, 0), vec3(0, -1, 0));
-	if (temp.x > 0.0 && temp.x < size.x && temp.z > 0.0 && temp.z < size.z && distance(origin, temp) < dist) {
-		dist = distance(origin, temp);
-		final = temp;
-		norm = vec3(0, -1, 0);
-	}
+	vec3 t0 = (boxMin - origin) / dir;
+	vec3 t1 = (boxMax - origin) / dir;
+	vec3 tNear = min(t0, t1);
+	vec3 tFar = max(t0, t1);
+
+	tEnter = max(max(tNear.x, tNear.y), tNear.z);
+	float tExit = min(min(tFar.x, tFar.y), tFar.z);
+
+	if (tEnter == tNear.x)
+		normal = vec3(-sign(dir.x), 0, 0);
+	else if (tEnter == tNear.y)
+		normal = vec3(0, -sign(dir.y), 0);
+	else
+		normal = vec3(0, 0, -sign(dir.z));
 
-	// Front
-	temp = rayPlaneIntersect(origin, dir, vec3(0, size.y, 0), vec3(0, 1, 0));
-	if (temp.x > 0.0 && temp.x < size.x && temp.z > 0.0 && temp.z < size.z && distance(origin, temp) < dist) {
-		dist = distance(origin, temp);
-		final = temp;
-		norm = vec3(0, 1, 0);
-	}
+	return tEnter <= tExit && tExit >= 0.0;
+}
 
-	hitPos = pos + final;
-	hitNormal = norm;
-	
-	return !isinf(dist);
+// Distances along a ray to the far boundaries of a block on each axis
+vec3 blockBoundaries(ivec3 coord, vec3 rayStart, vec3 rayDir)
+{
+	vec3 boundary = vec3(coord) + vec3(greaterThan(rayDir, vec3(0)));
+	return mix(vec3(1.0 / 0.0), (boundary - rayStart) / rayDir, notEqual(rayDir, vec3(0)));
 }
 
 // Get the color of a block at a certain point
@@ -119,25 +133,25 @@ vec4 blockColor(ivec3 block, vec3 pos, vec3 normal)
 {
 	vec3 localPos = pos - block;
 	int mat = getBlock(block);
-	float matOffset = float(mat - 1) * 1.0 / materialCount;
+	float matOffset = float(mat - 1) * 1.0 / MATERIAL_COUNT;
 
 	// Exception for grass, which uses the dirt texture on the sides if a block is on top of it
 	if (mat == 1 && abs(normal.x) + abs(normal.y) > 0.0 && getBlock(block + ivec3(0, 0, 1)) != 0) {
 		if (abs(normal.x) > 0.0) {
-			return texture(materials, vec2(matOffset + localPos.y / materialCount, 0.5 - localPos.z / 4.0));
+			return texture(materials, vec2(matOffset + localPos.y / MATERIAL_COUNT, 0.5 - localPos.z / 4.0));
 		} else {
-			return texture(materials, vec2(matOffset + localPos.x / materialCount, 0.5 - localPos.z / 4.0));
+			return texture(materials, vec2(matOffset + localPos.x / MATERIAL_COUNT, 0.5 - localPos.z / 4.0));
 		}
 	}
 
 	if (normal.z > 0.0) {
-		return texture(materials, vec2(matOffset + localPos.x / materialCount, 0.25 - localPos.y / materialCount));
+		return texture(materials, vec2(matOffset + localPos.x / MATERIAL_COUNT, 0.25 - localPos.y / MATERIAL_COUNT));
 	} else if (normal.z < 0.0) {
-		return texture(materials, vec2(matOffset + localPos.x / materialCount, 0.5 - localPos.y / 4.0));
+		return texture(materials, vec2(matOffset + localPos.x / MATERIAL_COUNT, 0.5 - localPos.y / 4.0));
 	} else if (abs(normal.x) > 0.0) {
-		return texture(materials, vec2(matOffset + localPos.y / materialCount, 0.75 - localPos.z / 4.0));
+		return texture(materials, vec2(matOffset + localPos.y / MATERIAL_COUNT, 0.75 - localPos.z / 4.0));
 	} else {
-		return texture(materials, vec2(matOffset + localPos.x / materialCount, 1.0 - localPos.z / 4.0));
+		return texture(materials, vec2(matOffset + localPos.x / MATERIAL_COUNT, 1.0 - localPos.z / 4.0));
 	}
 }
 
@@ -147,21 +161,26 @@ bool isTransparent(ivec3 block, vec3 pos, vec3 normal)
 	return col.r > 0.9 && col.g < 0.1 && col.b > 0.9;
 }
 
-// Convert a side normal to a single float value (used for picking)
-float normalAlpha(vec3 normal)
+// Encode the block hit by the primary ray as its coordinates, face and material, see renderer::pollHit
+uvec4 encodeHit(bool hit, ivec3 block, vec3 normal)
 {
-	if (normal.x > 0.0) return 0.0 / 255.0;
-	if (normal.x < 0.0) return 1.0 / 255.0;
-	if (normal.y > 0.0) return 2.0 / 255.0;
-	if (normal.y < 0.0) return 3.0 / 255.0;
-	if (normal.z > 0.0) return 4.0 / 255.0;
-	if (normal.z < 0.0) return 5.0 / 255.0;
+	if (!hit) return uvec4(0);
+
+	uint face = 6u;
+	if (normal.x > 0.0) face = 0u;
+	else if (normal.x < 0.0) face = 1u;
+	else if (normal.y > 0.0) face = 2u;
+	else if (normal.y < 0.0) face = 3u;
+	else if (normal.z > 0.0) face = 4u;
+	else if (normal.z < 0.0) face = 5u;
+
+	return uvec4(uvec3(block), 0x10000u | (uint(getBlock(block)) << 8) | face);
 }
 
 // Check if position is inside world
 bool posInsideWorld(vec3 pos)
 {
-	return pos.x >= 0.0 && pos.y >= 0.0 && pos.z >= 0.0 && pos.x <= sx && pos.y <= sy && pos.z <= sz;
+	return all(greaterThanEqual(pos, vec3(0.0))) && all(lessThanEqual(pos, vec3(WORLD_SIZE)));
 }
 
 // Traces a single ray and returns the resulting color
@@ -169,62 +188,116 @@ vec4 rayTrace(vec3 rayStart, vec3 rayDir, out bool hit, out ivec3 hitBlock, out
 {
 	hit = false;
 
+	ivec3 size = WORLD_SIZE;
+
 	// Ray tracing state
 	ivec3 coord;
-	vec3 rayPos;
-	vec3 hitP;
-	vec3 hitN;
+	vec3 normal;
+	float t;
+	bool skipBlock;
 
 	// Find the first position inside the world that is hit
 	if (posInsideWorld(rayStart)) {
-		coord = toBlock(rayStart, rayDir);
-		rayCube(rayStart, rayDir, coord, vec3(1, 1, 1), hitP, hitN);
+		// The block containing the start of the ray is skipped, like the block it was cast from
+		t = 0.0;
+		skipBlock = true;
 	} else {
-		if (!rayCube(rayStart, rayDir, vec3(0, 0, 0), vec3(sx, sy, sz), hitP, hitN)) {
-			if (pickMode)
-				return vec4(1.0, 1.0, 1.0, 1.0);
-			else
-				return skyColor;
-		}
+		if (!rayBox(rayStart, rayDir, vec3(0, 0, 0), vec3(size), t, normal))
+			return skyColor;
+
+		skipBlock = false;
 	}
 
+	coord = clamp(ivec3(floor(rayStart + rayDir * t)), ivec3(0), size - 1);
+
+	// Distances along the ray to the next block boundary on each axis and between boundaries
+	ivec3 stepDir = ivec3(sign(rayDir));
+	vec3 tDelta = abs(1.0 / rayDir);
+	vec3 tMax = blockBoundaries(coord, rayStart, rayDir);
+
 	// Iterate until the end of the world has been reached
 	int iterations = 0;
 
-	while (iterations < maxIterations && coord.x > -1 && coord.y > -1 && coord.z > -1 && coord.x < int(sx) + 1 && coord.y < int(sy) + 1 && coord.z < int(sz) + 1)
+	while (iterations < maxIterations)
 	{
-		if (iterations > 0) {
-			rayCube(rayPos, rayDir, coord, vec3(1, 1, 1), hitP, hitN);
+		// Find the largest box of empty blocks around the current one, either from the distance field or the occupancy pyramid
+		ivec3 boxMin = coord, boxMax = coord + 1;
+#ifdef USE_DISTANCE_FIELD
+		int dist = getDistance(coord);
+#else
+		int dist = 0;
+#endif
+
+		if (dist > 1) {
+			boxMin = coord - (dist - 1);
+			boxMax = coord + dist;
+		} else {
+			int levels = getEmptyLevels(coord);
+
+			if (levels > 0) {
+				int span = 1 << (2 * levels);
+				boxMin = coord & ~(span - 1);
+				boxMax = boxMin + span;
+			}
 		}
 
-		rayPos = hitP.xyz + rayDir * 0.0001;
-		coord = toBlock(rayPos, rayDir);
+		if (boxMax.x - boxMin.x > 1) {
+			// Jump over the empty box at once, its far boundaries are those of its corner block in the direction of the ray
+			ivec3 farCorner = boxMin + (boxMax - boxMin - 1) * ivec3(greaterThan(stepDir, ivec3(0)));
+			vec3 exits = blockBoundaries(farCorner, rayStart, rayDir);
+			int axis = exits.x <= exits.y && exits.x <= exits.z ? 0 : (exits.y <= exits.z ? 1 : 2);
+
+			t = max(t, exits[axis]);
+			coord = clamp(ivec3(floor(rayStart + rayDir * t)), boxMin, boxMax - 1);
+			coord[axis] += stepDir[axis];
 
-		// Normal has to be flipped, because it's from the side of the previous block
-		if (iterations > 0 || posInsideWorld(rayStart))
-			hitN = -hitN;
+			normal = vec3(0);
+			normal[axis] = float(-stepDir[axis]);
 
-		vec4 hitColor = blockColor(coord, hitP, hitN);
+			tMax = blockBoundaries(coord, rayStart, rayDir);
+		} else {
+			if (!skipBlock && getBlock(coord) != 0) {
+				vec3 hitP = rayStart + rayDir * t;
+				vec4 hitColor = blockColor(coord, hitP, normal);
 
-		if (getBlock(coord) != 0 && (pickMode || hitColor.r < 0.9 || hitColor.g > 0.1 || hitColor.b < 0.9)) {
-			hit = true;
-			hitBlock = coord;
-			hitPos = hitP;
-			hitNormal = hitN;
+				if (hitColor.r < 0.9 || hitColor.g > 0.1 || hitColor.b < 0.9) {
+					hit = true;
+					hitBlock = coord;
+					hitPos = hitP;
+					hitNormal = normal;
 
-			if (pickMode)
-				return vec4(coord / 255.0, normalAlpha(hitN));
-			else
-				return hitColor;
+					return hitColor;
+				}
+			}
+
+			// Step into the neighbouring block across the nearest boundary
+			if (tMax.x <= tMax.y && tMax.x <= tMax.z) {
+				coord.x += stepDir.x;
+				t = tMax.x;
+				tMax.x += tDelta.x;
+				normal = vec3(-stepDir.x, 0, 0);
+			} else if (tMax.y <= tMax.z) {
+				coord.y += stepDir.y;
+				t = tMax.y;
+				tMax.y += tDelta.y;
+				normal = vec3(0, -stepDir.y, 0);
+			} else {
+				coord.z += stepDir.z;
+				t = tMax.z;
+				tMax.z += tDelta.z;
+				normal = vec3(0, 0, -stepDir.z);
+			}
 		}
 
+		skipBlock = false;
+
+		if (any(lessThan(coord, ivec3(0))) || any(greaterThanEqual(coord, size)))
+			break;
+
 		iterations++;
 	}
 
-	if (pickMode)
-		return vec4(1.0, 1.0, 1.0, 1.0);
-	else
-		return skyColor;
+	return skyColor;
 }
 
 void main()
@@ -240,29 +313,47 @@ void main()
 	vec3 rootHitPos = hitPos;
 	vec3 rootHitNormal = hitNormal;
 
-	// If a block was hit, do a simple lighting trace
-	if (!pickMode && hit) {
-		rayTrace(hitPos + hitNormal * 0.001, vec3(1, 1, 1), hit, hitBlock, hitPos, hitNormal);
+#ifdef HIT_BUFFER
+	outHit = encodeHit(hit, rootHitBlock, rootHitNormal);
+	outDepth = hit ? distance(viewOrigin, rootHitPos) : 0.0;
+#endif
+
+	bool highlighted = hit && rootHitBlock == highlightBlock;
 
-		if (hit)
+	if (hit) {
+		bool shadowed = false;
+
+#ifdef SHADOWS
+		// Simple lighting trace
+		rayTrace(hitPos + hitNormal * 0.001, vec3(1, 1, 1), shadowed, hitBlock, hitPos, hitNormal);
+
+		if (shadowed)
 			outColor.xyz /= 2.0;
-		else {
-			// If a gold block was hit, do a simple reflection trace
-			if (getBlock(rootHitBlock) == 5) {
-				vec3 reflectNormal = 2 * rootHitNormal * dot(initialNormal, rootHitNormal) - initialNormal;
-				vec4 col = rayTrace(rootHitPos + rootHitNormal * 0.001, -reflectNormal, hit, hitBlock, hitPos, rootHitNormal);
+#endif
 
-				// Do lighting trace for reflection
-				if (hit) {
-					rayTrace(hitPos + hitNormal * 0.001, vec3(1, 1, 1), hit, hitBlock, hitPos, hitNormal);
+#ifdef REFLECTIONS
+		// If a lit gold block was hit, do a simple reflection trace
+		if (!shadowed && getBlock(rootHitBlock) == 5) {
+			vec3 reflectNormal = 2 * rootHitNormal * dot(initialNormal, rootHitNormal) - initialNormal;
+			vec4 col = rayTrace(rootHitPos + rootHitNormal * 0.001, -reflectNormal, hit, hitBlock, hitPos, hitNormal);
 
-					if (hit ) {
-						col /= 2.0;
-					}
-				}
+#ifdef SHADOWS
+			// Do lighting trace for reflection
+			if (hit) {
+				rayTrace(hitPos + hitNormal * 0.001, vec3(1, 1, 1), hit, hitBlock, hitPos, hitNormal);
 
-				outColor = mix(outColor, col, 0.3);
+				if (hit) {
+					col /= 2.0;
+				}
 			}
+#endif
+
+			outColor = mix(outColor, col, 0.3);
 		}
+#endif
 	}
-}
\ No newline at end of file
+
+	// Brighten the highlighted block
+	if (highlighted)
+		outColor.rgb = mix(outColor.rgb, vec3(1.0), 0.25);
+}
@@ -0,0 +1,122 @@
+#include <rc/scenes.hpp>
+#include <rc/terrain.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace rc
+{
+	namespace scenes
+	{
+		const char* const names[] = { "flat", "noise", "towers", "cave", "terrain", nullptr };
+
+		// Rolling hills of grass on stone
+		static void buildNoise(world& w)
+		{
+			world::batch b(w);
+
+			for (int y = 0; y < w.sizeY(); y++) {
+				for (int x = 0; x < w.sizeX(); x++) {
+					glm::vec3 p(x, y, 0.0f);
+					float n = 0.6f * noise::valueNoise(p / 48.0f, 1) + 0.3f * noise::valueNoise(p / 16.0f, 2) + 0.1f * noise::valueNoise(p / 6.0f, 3);
+					int height = std::max(1, int(w.sizeZ() * (0.1f + 0.5f * n)));
+
+					for (int z = 0; z < height; z++)
+						w.set(x, y, z, z < height - 1 ? material::STONE : material::GRASS);
+				}
+			}
+		}
+
+		// Thin ground with sparse tall towers, mostly air
+		static void buildTowers(world& w)
+		{
+			world::batch b(w);
+			std::mt19937 rng(1);
+
+			w.createFlatWorld(std::min(4, w.sizeZ()));
+
+			int count = std::max(1, w.sizeX() * w.sizeY() / 4096);
+
+			for (int i = 0; i < count; i++) {
+				int x = rng() % std::max(1, w.sizeX() - 8);
+				int y = rng() % std::max(1, w.sizeY() - 8);
+				int height = w.sizeZ() / 8 + rng() % std::max(1, w.sizeZ() * 3 / 4);
+
+				w.fill(box(glm::ivec3(x, y, 0), glm::ivec3(x + 8, y + 8, height)), material::STONE);
+			}
+		}
+
+		// Ring through which the cave camera path flies
+		static glm::vec3 caveRing(const world& w, float angle)
+		{
+			float radius = std::min(w.sizeX(), w.sizeY()) * 0.35f;
+			return glm::vec3(w.sizeX() * 0.5f + std::cos(angle) * radius, w.sizeY() * 0.5f + std::sin(angle) * radius, w.sizeZ() * 0.5f);
+		}
+
+		// Solid stone with caverns carved out of it and a tunnel for the camera
+		static void buildCave(world& w)
+		{
+			world::batch b(w);
+
+			w.fill(box(glm::ivec3(0, 0, 0), glm::ivec3(w.sizeX(), w.sizeY(), w.sizeZ())), material::STONE);
+
+			for (int z = 0; z < w.sizeZ(); z++) {
+				for (int y = 0; y < w.sizeY(); y++) {
+					for (int x = 0; x < w.sizeX(); x++) {
+						glm::vec3 p(x, y, z);
+						float n = 0.7f * noise::valueNoise(p / 12.0f, 4) + 0.3f * noise::valueNoise(p / 5.0f, 5);
+
+						if (n > 0.6f)
+							w.set(x, y, z, material::EMPTY);
+					}
+				}
+			}
+
+			float radius = std::min(w.sizeX(), w.sizeY()) * 0.35f;
+			int steps = std::max(8, int(radius * 3.0f));
+
+			for (int i = 0; i < steps; i++) {
+				glm::ivec3 center(caveRing(w, i * 6.2831853f / steps));
+				w.fill(box(center - glm::ivec3(3, 3, 2), center + glm::ivec3(4, 4, 3)), material::EMPTY);
+			}
+		}
+
+		bool build(const std::string& name, world& w)
+		{
+			if (name == "flat") {
+				w.createFlatWorld(std::max(1, w.sizeZ() / 8));
+			} else if (name == "noise") {
+				buildNoise(w);
+			} else if (name == "towers") {
+				buildTowers(w);
+			} else if (name == "cave") {
+				buildCave(w);
+			} else if (name == "terrain") {
+				terrain_generator(1).generate(w);
+			} else {
+				return false;
+			}
+
+			return true;
+		}
+
+		void cameraPath(const std::string& name, const world& w, int frame, int frameCount, glm::vec3& pos, glm::vec3& target)
+		{
+			float angle = 0.785f + frame * 6.2831853f / std::max(1, frameCount);
+
+			if (name == "cave") {
+				// Fly along the tunnel and look ahead
+				pos = caveRing(w, angle);
+				target = caveRing(w, angle + 0.2f);
+			} else {
+				// Circle above the surface while looking at the center
+				glm::vec3 center(w.sizeX() * 0.5f, w.sizeY() * 0.5f, w.sizeZ() * 0.2f);
+				float radius = std::min(w.sizeX(), w.sizeY()) * 0.45f;
+
+				pos = glm::vec3(center.x + std::cos(angle) * radius, center.y + std::sin(angle) * radius, w.sizeZ() * 0.8f);
+				target = center;
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,342 @@
+#include <rc/streamed_world.hpp>
+
+#include <algorithm>
+#include <utility>
+
+namespace rc
+{
+	static const int BRICK_SHIFT = world::BRICK_SHIFT;
+	static const int BRICK_SIZE = world::BRICK_SIZE;
+	static const int BRICK_VOLUME = world::BRICK_VOLUME;
+
+	const int streamed_world::READS_PER_TASK;
+
+	streamed_world::streamed_world(world_file& file, size_t capacity) : file(file)
+	{
+		maxBricks = std::max(capacity, size_t(1));
+		lastIndex = -1;
+		last = nullptr;
+
+		offsets.resize(BRICK_VOLUME);
+
+		for (int z = 0; z < BRICK_SIZE; z++)
+			for (int y = 0; y < BRICK_SIZE; y++)
+				for (int x = 0; x < BRICK_SIZE; x++)
+					offsets[(z << (2 * BRICK_SHIFT)) | (y << BRICK_SHIFT) | x] = uint16_t(world_file::blockOffset(file.layoutId(), x, y, z));
+
+		resetStats();
+	}
+
+	streamed_world::~streamed_world()
+	{
+		// Reads ahead use the file and this world, so they have to finish first
+		for (auto it = reading.begin(); it != reading.end(); ++it) {
+			it->second->cancelled = true;
+			cancelledTasks.push_back(it->second->task);
+		}
+
+		jobs::shared().wait(cancelledTasks);
+
+		flush();
+	}
+
+	int streamed_world::sizeX() const { return file.sizeX(); }
+	int streamed_world::sizeY() const { return file.sizeY(); }
+	int streamed_world::sizeZ() const { return file.sizeZ(); }
+
+	material::material_t streamed_world::get(int x, int y, int z)
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= file.sizeX() || y >= file.sizeY() || z >= file.sizeZ()) return material::EMPTY;
+
+		brick& b = fetch(x, y, z);
+
+		if (b.blocks.empty())
+			return b.uniform;
+		else
+			return material::material_t(b.blocks[offset(x, y, z)]);
+	}
+
+	bool streamed_world::set(int x, int y, int z, material::material_t mat)
+	{
+		// Changes to a file that can't be written would be lost when their brick is evicted
+		if (!file.isWritable()) return false;
+		if (x < 0 || y < 0 || z < 0 || x >= file.sizeX() || y >= file.sizeY() || z >= file.sizeZ()) return false;
+
+		brick& b = fetch(x, y, z);
+
+		if (b.blocks.empty()) {
+			if (b.uniform == mat) return true;
+			b.blocks.assign(BRICK_VOLUME, b.uniform);
+		}
+
+		b.blocks[offset(x, y, z)] = mat;
+		b.dirty = true;
+
+		return true;
+	}
+
+	// Distance from a point to the closest block of a brick
+	static float brickDistance(const glm::vec3& p, int bx, int by, int bz)
+	{
+		glm::vec3 lo = glm::vec3(bx, by, bz) * float(BRICK_SIZE);
+		return glm::length(glm::clamp(p, lo, lo + float(BRICK_SIZE)) - p);
+	}
+
+	void streamed_world::prefetch(const glm::vec3& camera, float radius)
+	{
+		// Without workers the reads would only run once get waits for them, which is slower than reading on a miss
+		if (jobs::shared().threadCount() <= 1) return;
+
+		int bsx = file.bricksX(), bsy = file.bricksY();
+
+		// Reads that aren't needed anymore are skipped if they haven't started yet
+		for (auto it = reading.begin(); it != reading.end();) {
+			int index = it->first;
+
+			if (brickDistance(camera, index % bsx, (index / bsx) % bsy, index / (bsx * bsy)) > radius) {
+				it->second->cancelled = true;
+				cancelledTasks.push_back(it->second->task);
+				counts.cancelled++;
+
+				it = reading.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		cancelledTasks.erase(std::remove_if(cancelledTasks.begin(), cancelledTasks.end(), [] (const jobs::task& t) {
+			return t.done();
+		}), cancelledTasks.end());
+
+		size_t budget = std::max(maxBricks / 2, size_t(1));
+		if (reading.size() >= budget) return;
+
+		glm::ivec3 bricksMax(bsx - 1, bsy - 1, file.bricksZ() - 1);
+		glm::ivec3 min = glm::clamp(glm::ivec3(glm::floor((camera - radius) / float(BRICK_SIZE))), glm::ivec3(0), bricksMax);
+		glm::ivec3 max = glm::clamp(glm::ivec3(glm::floor((camera + radius) / float(BRICK_SIZE))), glm::ivec3(0), bricksMax);
+
+		// Bricks that touch the sphere around the camera and aren't in memory or being read, by distance
+		std::vector<std::pair<float, int>> missing;
+
+		for (int bz = min.z; bz <= max.z; bz++) {
+			for (int by = min.y; by <= max.y; by++) {
+				for (int bx = min.x; bx <= max.x; bx++) {
+					int index = (bz * bsy + by) * bsx + bx;
+					if (bricks.find(index) != bricks.end() || reading.find(index) != reading.end()) continue;
+
+					float distance = brickDistance(camera, bx, by, bz);
+					if (distance <= radius) missing.push_back(std::make_pair(distance, index));
+				}
+			}
+		}
+
+		size_t count = std::min(missing.size(), budget - reading.size());
+		std::partial_sort(missing.begin(), missing.begin() + count, missing.end());
+
+		// Nearby bricks share a task, which is cheaper than a task per brick and still leaves enough tasks to spread
+		for (size_t first = 0; first < count; first += READS_PER_TASK) {
+			std::vector<std::pair<int, std::shared_ptr<read_ahead>>> reads;
+
+			for (size_t i = first; i < std::min(first + READS_PER_TASK, count); i++) {
+				std::shared_ptr<read_ahead> r = std::make_shared<read_ahead>();
+				r->b.reset(new brick());
+				r->cancelled = false;
+				r->ready = false;
+
+				reads.push_back(std::make_pair(missing[i].second, r));
+				reading[missing[i].second] = r;
+			}
+
+			jobs::task t = jobs::shared().submit([this, reads] () {
+				for (size_t i = 0; i < reads.size(); i++) {
+					if (!reads[i].second->cancelled) readBrick(reads[i].first, *reads[i].second->b);
+					reads[i].second->ready = true;
+				}
+			});
+
+			for (size_t i = 0; i < reads.size(); i++)
+				reads[i].second->task = t;
+		}
+
+		counts.prefetched += count;
+	}
+
+	bool streamed_world::flush()
+	{
+		bool ok = true;
+
+		for (auto it = bricks.begin(); it != bricks.end(); ++it) {
+			if (it->second->dirty && !writeBack(it->first, *it->second))
+				ok = false;
+		}
+
+		return ok;
+	}
+
+	size_t streamed_world::capacity() const
+	{
+		return maxBricks;
+	}
+
+	size_t streamed_world::residentBricks() const
+	{
+		return bricks.size();
+	}
+
+	const streamed_world::counters& streamed_world::stats() const
+	{
+		return counts;
+	}
+
+	void streamed_world::resetStats()
+	{
+		counts.hits = 0;
+		counts.misses = 0;
+		counts.waits = 0;
+		counts.evictions = 0;
+		counts.writes = 0;
+		counts.failedWrites = 0;
+		counts.prefetched = 0;
+		counts.cancelled = 0;
+	}
+
+	streamed_world::brick& streamed_world::fetch(int x, int y, int z)
+	{
+		int index = ((z >> BRICK_SHIFT) * file.bricksY() + (y >> BRICK_SHIFT)) * file.bricksX() + (x >> BRICK_SHIFT);
+
+		// The last brick is already the most recently used one
+		if (index == lastIndex) {
+			counts.hits++;
+			return *last;
+		}
+
+		auto it = bricks.find(index);
+
+		if (it != bricks.end()) {
+			counts.hits++;
+
+			brick& b = *it->second;
+			recent.splice(recent.begin(), recent, b.used);
+
+			lastIndex = index;
+			last = &b;
+
+			return b;
+		}
+
+		// A brick that is being read ahead only has to wait for that read
+		auto ahead = reading.find(index);
+
+		if (ahead != reading.end()) {
+			std::shared_ptr<read_ahead> r = ahead->second;
+			reading.erase(ahead);
+
+			if (r->ready) {
+				counts.hits++;
+			} else {
+				counts.waits++;
+				jobs::shared().wait(r->task);
+			}
+
+			return insert(index, std::move(r->b));
+		}
+
+		counts.misses++;
+
+		std::unique_ptr<brick> b(new brick());
+		readBrick(index, *b);
+
+		return insert(index, std::move(b));
+	}
+
+	streamed_world::brick& streamed_world::insert(int index, std::unique_ptr<brick> b)
+	{
+		while (bricks.size() >= maxBricks && evict()) {}
+
+		recent.push_front(index);
+		b->used = recent.begin();
+
+		brick& result = *b;
+		bricks[index] = std::move(b);
+
+		lastIndex = index;
+		last = &result;
+
+		return result;
+	}
+
+	bool streamed_world::evict()
+	{
+		// Changed bricks that can't be written back are kept, so their changes aren't lost
+		for (auto it = recent.end(); it != recent.begin();) {
+			int index = *--it;
+			auto b = bricks.find(index);
+
+			if (b->second->dirty && !writeBack(index, *b->second)) continue;
+
+			bricks.erase(b);
+			recent.erase(it);
+			counts.evictions++;
+
+			if (index == lastIndex) {
+				lastIndex = -1;
+				last = nullptr;
+			}
+
+			return true;
+		}
+
+		return false;
+	}
+
+	bool streamed_world::writeBack(int index, brick& b)
+	{
+		int bx = index % file.bricksX();
+		int by = (index / file.bricksX()) % file.bricksY();
+		int bz = index / (file.bricksX() * file.bricksY());
+
+		// Bricks that have become a single material again are stored as that material
+		uint8_t mat = uint8_t(b.uniform);
+		bool uniform = b.blocks.empty() || std::count(b.blocks.begin(), b.blocks.end(), b.blocks[0]) == BRICK_VOLUME;
+		const uint8_t* blocks = b.blocks.empty() ? &mat : &b.blocks[0];
+
+		if (!file.writeBrick(bx, by, bz, blocks, uniform)) {
+			counts.failedWrites++;
+			return false;
+		}
+
+		b.dirty = false;
+		counts.writes++;
+
+		return true;
+	}
+
+	bool streamed_world::readBrick(int index, brick& b) const
+	{
+		int bx = index % file.bricksX();
+		int by = (index / file.bricksX()) % file.bricksY();
+		int bz = index / (file.bricksX() * file.bricksY());
+
+		std::vector<uint8_t> blocks(BRICK_VOLUME);
+		bool uniform;
+
+		b.dirty = false;
+		b.uniform = material::EMPTY;
+
+		// Bricks that can't be read are treated as empty
+		if (!file.readBrick(bx, by, bz, &blocks[0], uniform)) return false;
+
+		if (uniform)
+			b.uniform = material::material_t(blocks[0]);
+		else
+			b.blocks.swap(blocks);
+
+		return true;
+	}
+
+	int streamed_world::offset(int x, int y, int z) const
+	{
+		int mask = BRICK_SIZE - 1;
+		return offsets[((z & mask) << (2 * BRICK_SHIFT)) | ((y & mask) << BRICK_SHIFT) | (x & mask)];
+	}
+}
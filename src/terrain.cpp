@@ -0,0 +1,247 @@
+#include <rc/terrain.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace rc
+{
+	// Octaves of the heightmap, each one with half the size and amplitude of the one before
+	static const int HEIGHT_OCTAVES = 5;
+
+	// Fraction of the world height below which the surface is sand instead of grass
+	static const float SAND_LEVEL = 0.3f;
+	static const int SAND_DEPTH = 4;
+
+	// Spacing of the lattice on which cave noise is evaluated and the ground that is kept above caves
+	static const int CAVE_STEP = 4;
+	static const int CAVE_CRUST = 4;
+	static const float CAVE_THRESHOLD = 0.62f;
+
+	// Every cell of the tree grid has at most one tree, whose leaves stay inside the cell
+	static const int TREE_CELL = 8;
+	static const int TREE_RADIUS = 2;
+	static const int TREE_CHANCE = 80;
+
+	// Independent streams of random values from the same seed
+	static const int HEIGHT_SALT = 0;
+	static const int CAVE_SALT = 16;
+	static const int TREE_SALT = 32;
+
+	static const int COLUMN_SIZE = world::BRICK_SIZE;
+	static const int CAVE_POINTS = COLUMN_SIZE / CAVE_STEP + 1;
+
+	static float smooth(float t)
+	{
+		return t * t * (3.0f - 2.0f * t);
+	}
+
+	uint32_t noise::hashLattice(int x, int y, int z, uint32_t seed)
+	{
+		uint32_t h = seed;
+		h = (h ^ uint32_t(x)) * 0x9e3779b1u;
+		h = (h ^ uint32_t(y)) * 0x85ebca77u;
+		h = (h ^ uint32_t(z)) * 0xc2b2ae3du;
+		h ^= h >> 16;
+		h *= 0x7feb352du;
+		h ^= h >> 15;
+
+		return h;
+	}
+
+	float noise::latticeValue(int x, int y, int z, uint32_t seed)
+	{
+		return (hashLattice(x, y, z, seed) >> 8) / float(0x1000000);
+	}
+
+	float noise::valueNoise(float px, float py, uint32_t seed)
+	{
+		float cx = std::floor(px), cy = std::floor(py);
+		float fx = smooth(px - cx), fy = smooth(py - cy);
+		int x = int(cx), y = int(cy);
+
+		float c0 = glm::mix(latticeValue(x, y, 0, seed), latticeValue(x + 1, y, 0, seed), fx);
+		float c1 = glm::mix(latticeValue(x, y + 1, 0, seed), latticeValue(x + 1, y + 1, 0, seed), fx);
+
+		return glm::mix(c0, c1, fy);
+	}
+
+	float noise::valueNoise(const glm::vec3& p, uint32_t seed)
+	{
+		glm::vec3 cell = glm::floor(p);
+		glm::vec3 f = p - cell;
+		f = f * f * (3.0f - 2.0f * f);
+
+		int x = int(cell.x), y = int(cell.y), z = int(cell.z);
+
+		float c00 = glm::mix(latticeValue(x, y, z, seed), latticeValue(x + 1, y, z, seed), f.x);
+		float c10 = glm::mix(latticeValue(x, y + 1, z, seed), latticeValue(x + 1, y + 1, z, seed), f.x);
+		float c01 = glm::mix(latticeValue(x, y, z + 1, seed), latticeValue(x + 1, y, z + 1, seed), f.x);
+		float c11 = glm::mix(latticeValue(x, y + 1, z + 1, seed), latticeValue(x + 1, y + 1, z + 1, seed), f.x);
+
+		return glm::mix(glm::mix(c00, c10, f.y), glm::mix(c01, c11, f.y), f.z);
+	}
+
+	static int sandLevel(int sz)
+	{
+		return int(sz * SAND_LEVEL);
+	}
+
+	terrain_generator::terrain_generator(uint32_t seed)
+	{
+		this->seed = seed;
+		this->threadCount = 0;
+	}
+
+	void terrain_generator::setThreadCount(int threads)
+	{
+		threadCount = threads;
+	}
+
+	void terrain_generator::generate(world& w) const
+	{
+		int sz = w.sizeZ();
+		int height = w.bricksZ() * world::BRICK_SIZE;
+
+		w.generate([&] (int x0, int y0, uint8_t* blocks) {
+			generateColumn(x0, y0, sz, height, blocks);
+		}, threadCount);
+	}
+
+	int terrain_generator::groundHeight(int x, int y, int sz) const
+	{
+		// Hills are about as wide as the world is high
+		float frequency = 1.0f / std::max(sz, 16);
+		float amplitude = 0.5f, total = 0.0f, n = 0.0f;
+
+		for (int i = 0; i < HEIGHT_OCTAVES; i++) {
+			n += amplitude * noise::valueNoise(x * frequency, y * frequency, seed + HEIGHT_SALT + i);
+			total += amplitude;
+
+			frequency *= 2.0f;
+			amplitude *= 0.5f;
+		}
+
+		// Widen the valleys and the tops of the hills
+		n = smooth(n / total);
+
+		return std::min(std::max(int(sz * (0.15f + 0.55f * n)), 1), sz);
+	}
+
+	void terrain_generator::generateColumn(int x0, int y0, int sz, int height, uint8_t* blocks) const
+	{
+		int ground[COLUMN_SIZE * COLUMN_SIZE];
+		int top = 1;
+
+		for (int y = 0; y < COLUMN_SIZE; y++) {
+			for (int x = 0; x < COLUMN_SIZE; x++) {
+				ground[y * COLUMN_SIZE + x] = groundHeight(x0 + x, y0 + y, sz);
+				top = std::max(top, ground[y * COLUMN_SIZE + x]);
+			}
+		}
+
+		// Cave density on the coarse lattice, up to the highest ground in the column
+		int layers = (top - 1) / CAVE_STEP + 2;
+		std::vector<float> density(size_t(layers) * CAVE_POINTS * CAVE_POINTS);
+
+		for (int lz = 0; lz < layers; lz++) {
+			for (int ly = 0; ly < CAVE_POINTS; ly++) {
+				for (int lx = 0; lx < CAVE_POINTS; lx++) {
+					glm::vec3 p(x0 + lx * CAVE_STEP, y0 + ly * CAVE_STEP, lz * CAVE_STEP);
+					float n = 0.7f * noise::valueNoise(p / 24.0f, seed + CAVE_SALT) + 0.3f * noise::valueNoise(p / 10.0f, seed + CAVE_SALT + 1);
+
+					density[(lz * CAVE_POINTS + ly) * CAVE_POINTS + lx] = n;
+				}
+			}
+		}
+
+		// Fill layer by layer in storage order, interpolating the density between lattice points
+		int sand = sandLevel(sz);
+
+		for (int z = 0; z < height; z++) {
+			uint8_t* layer = blocks + z * COLUMN_SIZE * COLUMN_SIZE;
+
+			if (z >= top) {
+				memset(layer, material::EMPTY, COLUMN_SIZE * COLUMN_SIZE);
+				continue;
+			}
+
+			const float* below = &density[(z / CAVE_STEP) * CAVE_POINTS * CAVE_POINTS];
+			const float* above = below + CAVE_POINTS * CAVE_POINTS;
+			float fz = (z % CAVE_STEP) / float(CAVE_STEP);
+
+			float plane[CAVE_POINTS * CAVE_POINTS];
+			for (int i = 0; i < CAVE_POINTS * CAVE_POINTS; i++)
+				plane[i] = glm::mix(below[i], above[i], fz);
+
+			for (int y = 0; y < COLUMN_SIZE; y++) {
+				const float* near = &plane[(y / CAVE_STEP) * CAVE_POINTS];
+				float fy = (y % CAVE_STEP) / float(CAVE_STEP);
+
+				float row[CAVE_POINTS];
+				for (int i = 0; i < CAVE_POINTS; i++)
+					row[i] = glm::mix(near[i], near[i + CAVE_POINTS], fy);
+
+				for (int x = 0; x < COLUMN_SIZE; x++) {
+					int g = ground[y * COLUMN_SIZE + x];
+					uint8_t m;
+
+					if (z >= g) {
+						m = material::EMPTY;
+					} else if (z > 0 && z < g - CAVE_CRUST && glm::mix(row[x / CAVE_STEP], row[x / CAVE_STEP + 1], (x % CAVE_STEP) / float(CAVE_STEP)) > CAVE_THRESHOLD) {
+						m = material::EMPTY;
+					} else if (g <= sand && z >= g - SAND_DEPTH) {
+						m = material::SAND;
+					} else {
+						m = z == g - 1 ? material::GRASS : material::STONE;
+					}
+
+					layer[y * COLUMN_SIZE + x] = m;
+				}
+			}
+		}
+
+		placeTrees(x0, y0, sz, blocks);
+	}
+
+	void terrain_generator::placeTrees(int x0, int y0, int sz, uint8_t* blocks) const
+	{
+		// Trees of the cells around the column can reach into it with their leaves
+		int sand = sandLevel(sz);
+
+		for (int cy = std::max(y0 - TREE_RADIUS, 0) / TREE_CELL; cy <= (y0 + COLUMN_SIZE - 1 + TREE_RADIUS) / TREE_CELL; cy++) {
+			for (int cx = std::max(x0 - TREE_RADIUS, 0) / TREE_CELL; cx <= (x0 + COLUMN_SIZE - 1 + TREE_RADIUS) / TREE_CELL; cx++) {
+				uint32_t h = noise::hashLattice(cx, cy, 0, seed + TREE_SALT);
+				if (int(h & 0xff) >= TREE_CHANCE) continue;
+
+				int tx = cx * TREE_CELL + TREE_RADIUS + int((h >> 8) & 0xff) % (TREE_CELL - 2 * TREE_RADIUS);
+				int ty = cy * TREE_CELL + TREE_RADIUS + int((h >> 16) & 0xff) % (TREE_CELL - 2 * TREE_RADIUS);
+				int trunk = 3 + int(h >> 24) % 3;
+				int radius = trunk == 5 ? 2 : 1;
+
+				// Trees only grow on grass and have to fit below the top of the world
+				int g = groundHeight(tx, ty, sz);
+				if (g <= sand || g + trunk + 1 >= sz) continue;
+
+				// Leaves around the top of the trunk, then the trunk itself
+				int minX = std::max(tx - radius, x0), maxX = std::min(tx + radius, x0 + COLUMN_SIZE - 1);
+				int minY = std::max(ty - radius, y0), maxY = std::min(ty + radius, y0 + COLUMN_SIZE - 1);
+
+				for (int z = g + trunk - 1; z <= g + trunk + 1; z++) {
+					for (int y = minY; y <= maxY; y++) {
+						for (int x = minX; x <= maxX; x++) {
+							uint8_t& b = blocks[(z * COLUMN_SIZE + y - y0) * COLUMN_SIZE + x - x0];
+							if (b == material::EMPTY) b = material::LEAF;
+						}
+					}
+				}
+
+				if (tx >= x0 && tx < x0 + COLUMN_SIZE && ty >= y0 && ty < y0 + COLUMN_SIZE) {
+					for (int z = g; z < g + trunk; z++)
+						blocks[(z * COLUMN_SIZE + ty - y0) * COLUMN_SIZE + tx - x0] = material::WOOD;
+				}
+			}
+		}
+	}
+}
@@ -1,62 +1,981 @@
 #include <rc/world.hpp>
+#include <rc/jobs.hpp>
+#include <rc/voxel_ray.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 
 namespace rc
 {
-	world::world(int sx, int sy, int sz)
+	// Upper bound on separately tracked dirty regions before they are merged
+	static const int MAX_DIRTY_REGIONS = 32;
+
+	// Smallest number of blocks for which a distance transform is spread over all cores
+	static const int PARALLEL_DISTANCE_VOLUME = 1 << 20;
+
+	// Largest changed region whose distances are repaired around the changed blocks instead of being recomputed
+	static const int REPAIR_DISTANCE_VOLUME = 4096;
+
+	// Rays traced together by one job in raycastMany
+	static const size_t RAYS_PER_BATCH = 256;
+
+	template <typename Layout> const int basic_world<Layout>::BRICK_SHIFT;
+	template <typename Layout> const int basic_world<Layout>::BRICK_SIZE;
+	template <typename Layout> const int basic_world<Layout>::BRICK_VOLUME;
+	template <typename Layout> const int basic_world<Layout>::JOURNAL_SIZE;
+	template <typename Layout> const int basic_world<Layout>::OCCUPANCY_LEVELS;
+	template <typename Layout> const int basic_world<Layout>::DISTANCE_LIMIT;
+
+	void mergeRegion(std::vector<box>& regions, const box& region, size_t maxRegions)
+	{
+		// Repeated edits usually fall inside a region that is already known
+		for (int i = 0; i < regions.size(); i++)
+			if (regions[i].contains(region)) return;
+
+		box r = region;
+
+		for (int i = 0; i < regions.size();) {
+			box m = r.merged(regions[i]);
+
+			if (m.volume() <= r.volume() + regions[i].volume()) {
+				r = m;
+				regions.erase(regions.begin() + i);
+				i = 0;
+			} else {
+				i++;
+			}
+		}
+
+		// Too many separate regions, merge with the one that grows the least
+		if (regions.size() >= maxRegions) {
+			int best = 0;
+			long long bestGrowth = -1;
+
+			for (int i = 0; i < regions.size(); i++) {
+				long long growth = r.merged(regions[i]).volume() - regions[i].volume();
+
+				if (bestGrowth < 0 || growth < bestGrowth) {
+					best = i;
+					bestGrowth = growth;
+				}
+			}
+
+			r = r.merged(regions[best]);
+			regions.erase(regions.begin() + best);
+		}
+
+		regions.push_back(r);
+	}
+
+	// Call func(i, scratch) for i in [0, count) on up to threads threads of the shared pool, or all of them
+	// if threads is 0, with a scratch buffer per chunk of slices
+	template <typename Func>
+	static void forEachSlice(int count, int threads, Func func)
+	{
+		jobs::shared().parallelFor(0, count, 0, [&] (int begin, int end) {
+			std::vector<int> scratch;
+
+			for (int i = begin; i < end; i++)
+				func(i, scratch);
+		}, threads);
+	}
+
+	// Distance to the nearest solid block along a row where solid blocks are 0 and empty ones limit
+	static void rowDistance(uint8_t* row, int n, int limit)
+	{
+		int d = limit;
+
+		for (int i = 0; i < n; i++) {
+			d = row[i] == 0 ? 0 : std::min(d + 1, limit);
+			row[i] = d;
+		}
+
+		d = limit;
+
+		for (int i = n - 1; i >= 0; i--) {
+			d = row[i] == 0 ? 0 : std::min(d + 1, limit);
+			row[i] = std::min(int(row[i]), d);
+		}
+	}
+
+	// Chessboard distance transform of a line of distances g(i) found along other axes (Meijster et al.),
+	// every element becomes the minimum of max(|u - i|, g(i)) over the line
+	static void lineDistance(uint8_t* line, int n, ptrdiff_t stride, std::vector<int>& scratch)
+	{
+		scratch.resize(3 * n);
+		int* g = &scratch[0];
+		int* s = g + n;
+		int* t = s + n;
+
+		for (int i = 0; i < n; i++)
+			g[i] = line[i * stride];
+
+		// Lower envelope of the functions of all elements, s are their positions and t where they start to be the minimum
+		int q = 0;
+		s[0] = 0;
+		t[0] = 0;
+
+		for (int u = 1; u < n; u++) {
+			while (q >= 0 && std::max(std::abs(t[q] - s[q]), g[s[q]]) > std::max(std::abs(t[q] - u), g[u]))
+				q--;
+
+			if (q < 0) {
+				q = 0;
+				s[0] = u;
+			} else {
+				int i = s[q];
+				int sep = g[i] <= g[u] ? std::max(i + g[u], (i + u) / 2) : std::min(u - g[i], (i + u) / 2);
+
+				if (sep + 1 < n) {
+					q++;
+					s[q] = u;
+					t[q] = sep + 1;
+				}
+			}
+		}
+
+		for (int u = n - 1; u >= 0; u--) {
+			line[u * stride] = std::max(std::abs(u - s[q]), g[s[q]]);
+			if (u == t[q]) q--;
+		}
+	}
+
+	template <typename Layout>
+	basic_world<Layout>::batch::batch(basic_world& w) : w(w)
+	{
+		w.batchDepth++;
+	}
+
+	template <typename Layout>
+	basic_world<Layout>::batch::~batch()
+	{
+		if (--w.batchDepth == 0)
+			w.flushDirty();
+	}
+
+	template <typename Layout>
+	basic_world<Layout>::basic_world(int sx, int sy, int sz)
 	{
 		this->sx = sx;
 		this->sy = sy;
 		this->sz = sz;
-		this->blocks = std::vector<material::material_t>(sx * sy * sz);
+
+		// Round up to whole bricks, the blocks beyond the world edge are never accessed
+		this->bsx = (sx + BRICK_SIZE - 1) >> BRICK_SHIFT;
+		this->bsy = (sy + BRICK_SIZE - 1) >> BRICK_SHIFT;
+		this->bsz = (sz + BRICK_SIZE - 1) >> BRICK_SHIFT;
+
+		brick empty;
+		empty.uniform = material::EMPTY;
+		empty.occupancy = 0;
+		this->bricks = std::vector<brick>(size_t(bsx) * bsy * bsz, empty);
+
+		// Regions of the occupancy pyramid group 4x4x4 bricks
+		this->rsx = (bsx + 3) >> 2;
+		this->rsy = (bsy + 3) >> 2;
+		this->rsz = (bsz + 3) >> 2;
+		this->occupiedRegions = std::vector<uint64_t>(size_t(rsx) * rsy * rsz, 0);
+
+		this->batchDepth = 0;
+
+		this->journal = std::vector<box>(JOURNAL_SIZE);
+		this->journalGeneration = 0;
 	}
 
-	void world::createFlatWorld(int height, material::material_t mat)
+	template <typename Layout>
+	void basic_world<Layout>::createFlatWorld(int height, material::material_t mat)
 	{
-		for (int x = 0; x < sx; x++)
-			for (int y = 0; y < sy; y++)
-				for (int z = 0; z < sz; z++)
-					blocks[toFlatIndex(x, y, z)] = z < height ? mat : material::EMPTY;
+		for (int z = 0; z < bsz; z++) {
+			int z0 = z * BRICK_SIZE;
+
+			for (int y = 0; y < bsy; y++) {
+				for (int x = 0; x < bsx; x++) {
+					brick& b = bricks[toBrickIndex(x, y, z)];
+
+					if (z0 + BRICK_SIZE <= height || z0 >= height) {
+						// Brick is entirely below or above the surface
+						b.uniform = z0 < height ? mat : material::EMPTY;
+						b.blocks.release();
+					} else {
+						// Brick contains the surface, fill it layer by layer
+						b.blocks.resize(BRICK_VOLUME);
+
+						for (int lz = 0; lz < BRICK_SIZE; lz++) {
+							uint8_t m = z0 + lz < height ? mat : material::EMPTY;
+
+							if (Layout::CONTIGUOUS_ROWS) {
+								memset(&b.blocks[toBrickOffset(0, 0, lz)], m, BRICK_SIZE * BRICK_SIZE);
+							} else {
+								for (int ly = 0; ly < BRICK_SIZE; ly++)
+									for (int lx = 0; lx < BRICK_SIZE; lx++)
+										b.blocks[toBrickOffset(lx, ly, lz)] = m;
+							}
+						}
+					}
+
+					updateOccupancy(x, y, z);
+				}
+			}
+		}
+
+		if (!distances.empty())
+			computeDistances(box(glm::ivec3(0, 0, 0), glm::ivec3(sx, sy, sz)));
 	}
 
-	int world::sizeX() const { return sx; }
-	int world::sizeY() const { return sy; }
-	int world::sizeZ() const { return sz; }
+	template <typename Layout>
+	void basic_world<Layout>::generate(const column_generator& gen, int threads)
+	{
+		batch b(*this);
+
+		int height = bsz * BRICK_SIZE;
+		int layerSize = BRICK_SIZE * BRICK_SIZE;
+
+		// Bricks in the same 64^3 region share its occupancy bits, so every task covers a whole column of regions
+		forEachSlice(rsx * rsy, threads, [&] (int task, std::vector<int>&) {
+			std::vector<uint8_t> column(size_t(layerSize) * height);
+			int rx = task % rsx, ry = task / rsx;
 
-	void world::addBlockCallback(std::function<void (int x, int y, int z, material::material_t mat)> func)
+			for (int by = ry * 4; by < std::min(ry * 4 + 4, bsy); by++) {
+				for (int bx = rx * 4; bx < std::min(rx * 4 + 4, bsx); bx++) {
+					int x0 = bx * BRICK_SIZE, y0 = by * BRICK_SIZE;
+					gen(x0, y0, &column[0]);
+
+					// Blocks beyond the edge of the world are kept empty
+					int ex = std::min(BRICK_SIZE, sx - x0), ey = std::min(BRICK_SIZE, sy - y0);
+
+					if (ex < BRICK_SIZE || ey < BRICK_SIZE || sz < height) {
+						for (int z = 0; z < height; z++) {
+							uint8_t* layer = &column[size_t(z) * layerSize];
+
+							if (z >= sz) {
+								memset(layer, material::EMPTY, layerSize);
+							} else {
+								memset(layer + ey * BRICK_SIZE, material::EMPTY, (BRICK_SIZE - ey) * BRICK_SIZE);
+								for (int y = 0; y < ey && ex < BRICK_SIZE; y++)
+									memset(layer + y * BRICK_SIZE + ex, material::EMPTY, BRICK_SIZE - ex);
+							}
+						}
+					}
+
+					for (int bz = 0; bz < bsz; bz++)
+						storeBrick(bx, by, bz, &column[size_t(bz) * BRICK_VOLUME]);
+				}
+			}
+		});
+
+		markDirty(box(glm::ivec3(0, 0, 0), glm::ivec3(sx, sy, sz)));
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::generateBricks(const brick_generator& gen, int threads)
 	{
-		callbacks.push_back(func);
+		batch b(*this);
+
+		// Same split into columns of regions as generate, so that no two tasks touch the same occupancy bits
+		forEachSlice(rsx * rsy, threads, [&] (int task, std::vector<int>&) {
+			std::vector<uint8_t> blocks(BRICK_VOLUME);
+			int rx = task % rsx, ry = task / rsx;
+
+			for (int bz = 0; bz < bsz; bz++) {
+				for (int by = ry * 4; by < std::min(ry * 4 + 4, bsy); by++) {
+					for (int bx = rx * 4; bx < std::min(rx * 4 + 4, bsx); bx++) {
+						brick& br = bricks[toBrickIndex(bx, by, bz)];
+						material::material_t uniform = material::EMPTY;
+
+						if (gen(bx, by, bz, &blocks[0], uniform)) {
+							br.blocks.assign(&blocks[0], &blocks[0] + BRICK_VOLUME);
+						} else {
+							br.uniform = uniform;
+							br.blocks.release();
+						}
+
+						updateOccupancy(bx, by, bz);
+					}
+				}
+			}
+		});
+
+		markDirty(box(glm::ivec3(0, 0, 0), glm::ivec3(sx, sy, sz)));
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::mapBricks(const std::vector<mapped_brick>& mapped, const std::shared_ptr<void>& owner, bool writable)
+	{
+		batch b(*this);
+
+		for (int i = 0; i < bricks.size() && i < mapped.size(); i++) {
+			brick& br = bricks[i];
+
+			if (mapped[i].blocks != nullptr) {
+				br.blocks.borrow(mapped[i].blocks, BRICK_VOLUME, writable);
+			} else {
+				br.uniform = mapped[i].uniform;
+				br.blocks.release();
+			}
+
+			br.occupancy = mapped[i].occupancy;
+		}
+
+		storageOwner = owner;
+
+		// Regions only need the masks of the bricks, so no blocks are touched
+		for (int bz = 0; bz < bsz; bz++)
+			for (int by = 0; by < bsy; by++)
+				for (int bx = 0; bx < bsx; bx++)
+					updateRegionOccupancy(bx, by, bz);
+
+		markDirty(box(glm::ivec3(0, 0, 0), glm::ivec3(sx, sy, sz)));
 	}
 
-	void world::set(int x, int y, int z, material::material_t mat)
+	template <typename Layout>
+	int basic_world<Layout>::sizeX() const { return sx; }
+
+	template <typename Layout>
+	int basic_world<Layout>::sizeY() const { return sy; }
+
+	template <typename Layout>
+	int basic_world<Layout>::sizeZ() const { return sz; }
+
+	template <typename Layout>
+	uint64_t basic_world<Layout>::generation() const
+	{
+		return journalGeneration;
+	}
+
+	template <typename Layout>
+	bool basic_world<Layout>::pollChanges(uint64_t& cursor, std::vector<box>& regions) const
+	{
+		regions.clear();
+
+		if (journalGeneration - cursor > JOURNAL_SIZE) {
+			cursor = journalGeneration;
+			return false;
+		}
+
+		for (uint64_t g = cursor; g < journalGeneration; g++)
+			mergeRegion(regions, journal[g % JOURNAL_SIZE], MAX_DIRTY_REGIONS);
+
+		cursor = journalGeneration;
+		return true;
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::set(int x, int y, int z, material::material_t mat)
 	{
 		if (x >= 0 && y >= 0 && z >= 0 && x < sx && y < sy && z < sz) {
-			blocks[toFlatIndex(x, y, z)] = mat;
+			batch b(*this);
+
+			setBlock(x, y, z, mat);
+			markDirty(box(glm::ivec3(x, y, z), glm::ivec3(x + 1, y + 1, z + 1)));
+		}
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::setMany(const block_edit* edits, size_t count)
+	{
+		batch b(*this);
+
+		for (size_t i = 0; i < count; i++) {
+			const block_edit& e = edits[i];
+
+			if (e.x >= 0 && e.y >= 0 && e.z >= 0 && e.x < sx && e.y < sy && e.z < sz) {
+				setBlock(e.x, e.y, e.z, e.mat);
+				markDirty(box(glm::ivec3(e.x, e.y, e.z), glm::ivec3(e.x + 1, e.y + 1, e.z + 1)));
+			}
+		}
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::setMany(const std::vector<block_edit>& edits)
+	{
+		if (!edits.empty())
+			setMany(&edits[0], edits.size());
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::fill(const box& region, material::material_t mat)
+	{
+		box worldBox(glm::ivec3(0, 0, 0), glm::ivec3(sx, sy, sz));
+		box r = region.clipped(worldBox);
+		if (r.empty()) return;
+
+		batch b(*this);
+
+		for (int bz = r.min.z >> BRICK_SHIFT; bz <= (r.max.z - 1) >> BRICK_SHIFT; bz++) {
+			for (int by = r.min.y >> BRICK_SHIFT; by <= (r.max.y - 1) >> BRICK_SHIFT; by++) {
+				for (int bx = r.min.x >> BRICK_SHIFT; bx <= (r.max.x - 1) >> BRICK_SHIFT; bx++) {
+					brick& br = bricks[toBrickIndex(bx, by, bz)];
+
+					glm::ivec3 origin(bx * BRICK_SIZE, by * BRICK_SIZE, bz * BRICK_SIZE);
+					box brickBox = box(origin, origin + glm::ivec3(BRICK_SIZE)).clipped(worldBox);
+					box part = brickBox.clipped(r);
 
-			for (int i = 0; i < callbacks.size(); i++)
-				callbacks[i](x, y, z, mat);
+					if (part.volume() == brickBox.volume()) {
+						// Region covers the brick, so it becomes uniform
+						br.uniform = mat;
+						br.blocks.release();
+					} else if (!br.blocks.empty() || br.uniform != mat) {
+						expandBrick(br);
+
+						for (int z = part.min.z; z < part.max.z; z++) {
+							for (int y = part.min.y; y < part.max.y; y++) {
+								if (Layout::CONTIGUOUS_ROWS) {
+									memset(&br.blocks[toBrickOffset(part.min.x - origin.x, y - origin.y, z - origin.z)], mat, part.max.x - part.min.x);
+								} else {
+									for (int x = part.min.x; x < part.max.x; x++)
+										br.blocks[toBrickOffset(x - origin.x, y - origin.y, z - origin.z)] = mat;
+								}
+							}
+						}
+					}
+
+					updateOccupancy(bx, by, bz);
+				}
+			}
 		}
+
+		markDirty(r);
 	}
 
-	material::material_t world::get(int x, int y, int z) const
+	template <typename Layout>
+	material::material_t basic_world<Layout>::get(int x, int y, int z) const
 	{
 		if (x >= 0 && y >= 0 && z >= 0 && x < sx && y < sy && z < sz) {
-			return blocks[toFlatIndex(x, y, z)];
+			return getUnchecked(x, y, z);
 		} else {
 			return material::EMPTY;
 		}
 	}
 
-	material::material_t world::get(int i) const
+	template <typename Layout>
+	material::material_t basic_world<Layout>::get(size_t i) const
 	{
-		if (i < sx * sy * sz) {
-			return blocks[i];
+		if (i < size_t(sx) * sy * sz) {
+			return get(int(i % sx), int((i / sx) % sy), int(i / (size_t(sx) * sy)));
 		} else {
 			return material::EMPTY;
 		}
 	}
 
-	int world::toFlatIndex(int x, int y, int z) const
+	template <typename Layout>
+	size_t basic_world<Layout>::toFlatIndex(int x, int y, int z) const
+	{
+		return (size_t(z) * sy + y) * sx + x;
+	}
+
+	template <typename Layout>
+	ray_hit basic_world<Layout>::raycast(const glm::vec3& origin, const glm::vec3& dir, float maxDist) const
+	{
+		ray_hit result;
+		result.hit = false;
+
+		if (dir == glm::vec3(0.0f)) return result;
+
+		// Traverse with a unit direction, so that distances along the ray are in blocks
+		voxel_ray ray(origin, glm::normalize(dir), glm::ivec3(sx, sy, sz));
+		if (!ray.hitsGrid()) return result;
+
+		while (ray.inside() && ray.distance() <= maxDist) {
+			glm::ivec3 coord = ray.block();
+			glm::ivec3 boxMin, boxMax;
+
+			if (!findEmptyBox(coord, boxMin, boxMax)) {
+				result.hit = true;
+				result.block = coord;
+				result.normal = ray.normal();
+				result.distance = ray.distance();
+				result.mat = getUnchecked(coord.x, coord.y, coord.z);
+
+				return result;
+			}
+
+			// Jump over empty space like the renderer does
+			if (boxMax.x - boxMin.x > 1)
+				ray.skip(boxMin, boxMax);
+			else
+				ray.step();
+		}
+
+		return result;
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::raycastMany(const ray* rays, ray_hit* hits, size_t count) const
+	{
+		// Every ray is traced exactly like raycast, batches of rays are spread over the job pool
+		int batches = int((count + RAYS_PER_BATCH - 1) / RAYS_PER_BATCH);
+
+		jobs::shared().parallelFor(0, batches, 0, [&] (int begin, int end) {
+			size_t last = std::min(size_t(end) * RAYS_PER_BATCH, count);
+
+			for (size_t i = size_t(begin) * RAYS_PER_BATCH; i < last; i++)
+				hits[i] = raycast(rays[i].origin, rays[i].dir, rays[i].maxDist);
+		});
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::raycastMany(const std::vector<ray>& rays, std::vector<ray_hit>& hits) const
+	{
+		hits.resize(rays.size());
+
+		if (!rays.empty())
+			raycastMany(&rays[0], &hits[0], rays.size());
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::copyRegion(const box& region, uint8_t* out) const
+	{
+		int w = region.max.x - region.min.x;
+		int h = region.max.y - region.min.y;
+
+		for (int z = region.min.z; z < region.max.z; z++) {
+			for (int y = region.min.y; y < region.max.y; y++) {
+				uint8_t* row = out + (ptrdiff_t(z - region.min.z) * h + (y - region.min.y)) * w - region.min.x;
+
+				// Copy the row in runs that each lie within a single brick
+				for (int x = region.min.x; x < region.max.x;) {
+					int end = std::min(region.max.x, (x | (BRICK_SIZE - 1)) + 1);
+					const brick& b = bricks[toBrickIndex(x >> BRICK_SHIFT, y >> BRICK_SHIFT, z >> BRICK_SHIFT)];
+
+					if (b.blocks.empty()) {
+						memset(row + x, b.uniform, end - x);
+					} else if (Layout::CONTIGUOUS_ROWS) {
+						memcpy(row + x, &b.blocks[toBrickOffset(x & (BRICK_SIZE - 1), y & (BRICK_SIZE - 1), z & (BRICK_SIZE - 1))], end - x);
+					} else {
+						for (int i = x; i < end; i++)
+							row[i] = b.blocks[toBrickOffset(i & (BRICK_SIZE - 1), y & (BRICK_SIZE - 1), z & (BRICK_SIZE - 1))];
+					}
+
+					x = end;
+				}
+			}
+		}
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::buildDistanceField()
+	{
+		distances.resize(size_t(sx) * sy * sz);
+		computeDistances(box(glm::ivec3(0, 0, 0), glm::ivec3(sx, sy, sz)));
+	}
+
+	template <typename Layout>
+	bool basic_world<Layout>::hasDistanceField() const
+	{
+		return !distances.empty();
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::copyDistanceRegion(const box& region, uint8_t* out) const
+	{
+		int w = region.max.x - region.min.x;
+
+		for (int z = region.min.z; z < region.max.z; z++)
+			for (int y = region.min.y; y < region.max.y; y++, out += w)
+				memcpy(out, &distances[(size_t(z) * sy + y) * sx + region.min.x], w);
+	}
+
+	template <typename Layout>
+	int basic_world<Layout>::bricksX() const { return bsx; }
+
+	template <typename Layout>
+	int basic_world<Layout>::bricksY() const { return bsy; }
+
+	template <typename Layout>
+	int basic_world<Layout>::bricksZ() const { return bsz; }
+
+	template <typename Layout>
+	bool basic_world<Layout>::isUniformBrick(int bx, int by, int bz) const
+	{
+		return bricks[toBrickIndex(bx, by, bz)].blocks.empty();
+	}
+
+	template <typename Layout>
+	material::material_t basic_world<Layout>::brickMaterial(int bx, int by, int bz) const
+	{
+		return bricks[toBrickIndex(bx, by, bz)].uniform;
+	}
+
+	template <typename Layout>
+	uint64_t basic_world<Layout>::brickOccupancy(int bx, int by, int bz) const
 	{
-		return z * sy * sx + y * sx + x;
+		return bricks[toBrickIndex(bx, by, bz)].occupancy;
+	}
+
+	template <typename Layout>
+	block_span basic_world<Layout>::brickData(int bx, int by, int bz) const
+	{
+		const brick& b = bricks[toBrickIndex(bx, by, bz)];
+
+		if (b.blocks.empty())
+			return block_span(nullptr, 0);
+		else
+			return block_span(&b.blocks[0], b.blocks.size());
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::compact()
+	{
+		for (int i = 0; i < bricks.size(); i++) {
+			brick& b = bricks[i];
+			if (b.blocks.empty()) continue;
+
+			// Only blocks inside the world count, the padding of edge bricks is ignored
+			int x0 = (i % bsx) * BRICK_SIZE;
+			int y0 = ((i / bsx) % bsy) * BRICK_SIZE;
+			int z0 = (i / (bsx * bsy)) * BRICK_SIZE;
+
+			int ex = std::min(BRICK_SIZE, sx - x0);
+			int ey = std::min(BRICK_SIZE, sy - y0);
+			int ez = std::min(BRICK_SIZE, sz - z0);
+
+			uint8_t first = b.blocks[0];
+			bool uniform = true;
+
+			for (int z = 0; z < ez && uniform; z++)
+				for (int y = 0; y < ey && uniform; y++)
+					for (int x = 0; x < ex && uniform; x++)
+						uniform = b.blocks[toBrickOffset(x, y, z)] == first;
+
+			if (uniform) {
+				b.uniform = material::material_t(first);
+				b.blocks.release();
+			}
+		}
+	}
+
+	template <typename Layout>
+	size_t basic_world<Layout>::memoryUsage() const
+	{
+		size_t bytes = bricks.size() * sizeof(brick) + distances.capacity();
+
+		for (int i = 0; i < bricks.size(); i++)
+			bytes += bricks[i].blocks.capacity();
+
+		return bytes;
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::expandBrick(brick& b)
+	{
+		if (b.blocks.empty())
+			b.blocks.assign(BRICK_VOLUME, b.uniform);
+		else
+			b.blocks.makeWritable();
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::storeBrick(int bx, int by, int bz, const uint8_t* blocks)
+	{
+		brick& b = bricks[toBrickIndex(bx, by, bz)];
+
+		// Only blocks inside the world decide whether the brick is uniform
+		int ex = std::min(BRICK_SIZE, sx - bx * BRICK_SIZE);
+		int ey = std::min(BRICK_SIZE, sy - by * BRICK_SIZE);
+		int ez = std::min(BRICK_SIZE, sz - bz * BRICK_SIZE);
+
+		uint8_t first = blocks[0];
+		bool uniform = true;
+
+		for (int z = 0; z < ez && uniform; z++)
+			for (int y = 0; y < ey && uniform; y++)
+				for (int x = 0; x < ex && uniform; x++)
+					uniform = blocks[(z * BRICK_SIZE + y) * BRICK_SIZE + x] == first;
+
+		if (uniform) {
+			b.uniform = material::material_t(first);
+			b.blocks.release();
+		} else {
+			b.blocks.resize(BRICK_VOLUME);
+
+			for (int z = 0; z < BRICK_SIZE; z++) {
+				for (int y = 0; y < BRICK_SIZE; y++) {
+					const uint8_t* row = blocks + (z * BRICK_SIZE + y) * BRICK_SIZE;
+
+					if (Layout::CONTIGUOUS_ROWS) {
+						memcpy(&b.blocks[toBrickOffset(0, y, z)], row, BRICK_SIZE);
+					} else {
+						for (int x = 0; x < BRICK_SIZE; x++)
+							b.blocks[toBrickOffset(x, y, z)] = row[x];
+					}
+				}
+			}
+		}
+
+		updateOccupancy(bx, by, bz);
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::setBlock(int x, int y, int z, material::material_t mat)
+	{
+		brick& b = bricks[toBrickIndex(x >> BRICK_SHIFT, y >> BRICK_SHIFT, z >> BRICK_SHIFT)];
+
+		if (!b.blocks.empty() || b.uniform != mat) {
+			expandBrick(b);
+			b.blocks[toBrickOffset(x & (BRICK_SIZE - 1), y & (BRICK_SIZE - 1), z & (BRICK_SIZE - 1))] = mat;
+		}
+
+		// Update the 4^3 node of the block, an emptied node has to be checked for other solid blocks
+		uint64_t bit = uint64_t(1) << toNodeBit(x >> 2, y >> 2, z >> 2);
+
+		if (mat != material::EMPTY) {
+			b.occupancy |= bit;
+		} else if (b.occupancy & bit) {
+			int nx = x & (BRICK_SIZE - 4), ny = y & (BRICK_SIZE - 4), nz = z & (BRICK_SIZE - 4);
+			bool solid = false;
+
+			for (int lz = nz; lz < nz + 4 && !solid; lz++)
+				for (int ly = ny; ly < ny + 4 && !solid; ly++)
+					for (int lx = nx; lx < nx + 4 && !solid; lx++)
+						solid = b.blocks[toBrickOffset(lx, ly, lz)] != material::EMPTY;
+
+			if (!solid) b.occupancy &= ~bit;
+		}
+
+		updateRegionOccupancy(x >> BRICK_SHIFT, y >> BRICK_SHIFT, z >> BRICK_SHIFT);
 	}
+
+	template <typename Layout>
+	void basic_world<Layout>::updateOccupancy(int bx, int by, int bz)
+	{
+		brick& b = bricks[toBrickIndex(bx, by, bz)];
+
+		if (b.blocks.empty()) {
+			b.occupancy = b.uniform != material::EMPTY ? ~uint64_t(0) : 0;
+		} else {
+			b.occupancy = 0;
+
+			for (int z = 0; z < BRICK_SIZE; z++)
+				for (int y = 0; y < BRICK_SIZE; y++)
+					for (int x = 0; x < BRICK_SIZE; x++)
+						if (b.blocks[toBrickOffset(x, y, z)] != material::EMPTY)
+							b.occupancy |= uint64_t(1) << toNodeBit(x >> 2, y >> 2, z >> 2);
+		}
+
+		updateRegionOccupancy(bx, by, bz);
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::updateRegionOccupancy(int bx, int by, int bz)
+	{
+		uint64_t& region = occupiedRegions[toRegionIndex(bx >> 2, by >> 2, bz >> 2)];
+		uint64_t bit = uint64_t(1) << toNodeBit(bx, by, bz);
+
+		if (bricks[toBrickIndex(bx, by, bz)].occupancy != 0)
+			region |= bit;
+		else
+			region &= ~bit;
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::computeDistances(const box& region)
+	{
+		// Blocks further away than the limit can't change the capped distances inside the region
+		box worldBox(glm::ivec3(0, 0, 0), glm::ivec3(sx, sy, sz));
+		box r = region.clipped(worldBox);
+		box source = box(r.min - DISTANCE_LIMIT, r.max + DISTANCE_LIMIT).clipped(worldBox);
+		glm::ivec3 n = source.max - source.min;
+
+		std::vector<uint8_t> field(size_t(n.x) * n.y * n.z);
+		copyRegion(source, &field[0]);
+
+		bool parallel = field.size() >= PARALLEL_DISTANCE_VOLUME;
+
+		// Separable transform, first along x and y within each z slice and then along z. Later passes
+		// only need the lines that cross the region itself.
+		glm::ivec3 o = r.min - source.min;
+		glm::ivec3 m = r.max - r.min;
+
+		forEachSlice(n.z, parallel ? 0 : 1, [&] (int z, std::vector<int>& scratch) {
+			uint8_t* slice = &field[size_t(z) * n.y * n.x];
+
+			for (int y = 0; y < n.y; y++) {
+				uint8_t* row = slice + y * n.x;
+
+				for (int x = 0; x < n.x; x++)
+					row[x] = row[x] == material::EMPTY ? DISTANCE_LIMIT : 0;
+
+				rowDistance(row, n.x, DISTANCE_LIMIT);
+			}
+
+			for (int x = o.x; x < o.x + m.x; x++)
+				lineDistance(slice + x, n.y, n.x, scratch);
+		});
+
+		forEachSlice(m.y, parallel ? 0 : 1, [&] (int y, std::vector<int>& scratch) {
+			for (int x = o.x; x < o.x + m.x; x++)
+				lineDistance(&field[(o.y + y) * n.x + x], n.z, ptrdiff_t(n.x) * n.y, scratch);
+		});
+
+		for (int z = 0; z < m.z; z++)
+			for (int y = 0; y < m.y; y++)
+				memcpy(&distances[(size_t(r.min.z + z) * sy + r.min.y + y) * sx + r.min.x], &field[(size_t(o.z + z) * n.y + o.y + y) * n.x + o.x], m.x);
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::repairDistances(const box& region)
+	{
+		// Chebyshev distance is the number of steps to the nearest solid block between blocks that touch, so the
+		// field is a breadth-first search from the solid blocks. Distances are spread in increasing order from
+		// buckets, and a block that is in a bucket with a distance it no longer has is skipped.
+		std::vector<glm::ivec3> buckets[DISTANCE_LIMIT];
+
+		// Blocks that may have had their distance from a removed solid block, with that distance
+		std::vector<std::pair<glm::ivec3, int>> raised;
+
+		// Solid blocks added far away from others, which lower the distances of most of the cube around them
+		std::vector<glm::ivec3> isolated;
+
+		box worldBox(glm::ivec3(0, 0, 0), glm::ivec3(sx, sy, sz));
+		box r = region.clipped(worldBox);
+
+		for (int z = r.min.z; z < r.max.z; z++) {
+			for (int y = r.min.y; y < r.max.y; y++) {
+				for (int x = r.min.x; x < r.max.x; x++) {
+					uint8_t& d = distances[(size_t(z) * sy + y) * sx + x];
+					bool solid = getUnchecked(x, y, z) != material::EMPTY;
+
+					if (solid && d != 0) {
+						if (d >= DISTANCE_LIMIT / 2) isolated.push_back(glm::ivec3(x, y, z));
+
+						d = 0;
+						buckets[0].push_back(glm::ivec3(x, y, z));
+					} else if (!solid && d == 0) {
+						d = DISTANCE_LIMIT;
+						raised.push_back(std::make_pair(glm::ivec3(x, y, z), 0));
+					}
+				}
+			}
+		}
+
+		// Whether a block still has a neighbour one step closer to a solid block than its distance
+		auto supported = [&] (const glm::ivec3& p, int distance) -> bool {
+			glm::ivec3 lo = glm::max(p - 1, worldBox.min), hi = glm::min(p + 1, worldBox.max - 1);
+
+			for (int z = lo.z; z <= hi.z; z++)
+				for (int y = lo.y; y <= hi.y; y++)
+					for (int x = lo.x; x <= hi.x; x++)
+						if (distances[(size_t(z) * sy + y) * sx + x] == distance - 1) return true;
+
+			return false;
+		};
+
+		// Neighbours that are one further away may have depended on a raised block and start over as well, unless
+		// another neighbour still supports their distance. Blocks are raised in order of their old distance, so
+		// all blocks that lose a distance are raised before the blocks one further away are checked. The other
+		// neighbours keep a distance that is still valid, so they spread it back into the raised blocks.
+		for (size_t i = 0; i < raised.size(); i++) {
+			glm::ivec3 p = raised[i].first;
+			glm::ivec3 lo = glm::max(p - 1, worldBox.min), hi = glm::min(p + 1, worldBox.max - 1);
+
+			for (int z = lo.z; z <= hi.z; z++) {
+				for (int y = lo.y; y <= hi.y; y++) {
+					for (int x = lo.x; x <= hi.x; x++) {
+						uint8_t& d = distances[(size_t(z) * sy + y) * sx + x];
+
+						if (d == raised[i].second + 1 && d < DISTANCE_LIMIT && !supported(glm::ivec3(x, y, z), d)) {
+							raised.push_back(std::make_pair(glm::ivec3(x, y, z), int(d)));
+							d = DISTANCE_LIMIT;
+						} else if (d < DISTANCE_LIMIT - 1) {
+							buckets[d].push_back(glm::ivec3(x, y, z));
+						}
+					}
+				}
+			}
+		}
+
+		// Lowering the cube around such a block directly is cheaper than spreading through it, and leaves nothing to
+		// spread from it afterwards
+		for (size_t i = 0; i < isolated.size(); i++) {
+			glm::ivec3 lo = glm::max(isolated[i] - (DISTANCE_LIMIT - 1), worldBox.min);
+			glm::ivec3 hi = glm::min(isolated[i] + (DISTANCE_LIMIT - 1), worldBox.max - 1);
+
+			for (int z = lo.z; z <= hi.z; z++) {
+				for (int y = lo.y; y <= hi.y; y++) {
+					uint8_t* row = &distances[(size_t(z) * sy + y) * sx];
+					int dzy = std::max(std::abs(z - isolated[i].z), std::abs(y - isolated[i].y));
+
+					for (int x = lo.x; x <= hi.x; x++)
+						row[x] = uint8_t(std::min(int(row[x]), std::max(dzy, std::abs(x - isolated[i].x))));
+				}
+			}
+		}
+
+		for (int distance = 0; distance < DISTANCE_LIMIT - 1; distance++) {
+			for (size_t i = 0; i < buckets[distance].size(); i++) {
+				glm::ivec3 p = buckets[distance][i];
+				if (distances[(size_t(p.z) * sy + p.y) * sx + p.x] != distance) continue;
+
+				glm::ivec3 lo = glm::max(p - 1, worldBox.min), hi = glm::min(p + 1, worldBox.max - 1);
+
+				for (int z = lo.z; z <= hi.z; z++) {
+					for (int y = lo.y; y <= hi.y; y++) {
+						for (int x = lo.x; x <= hi.x; x++) {
+							uint8_t& d = distances[(size_t(z) * sy + y) * sx + x];
+
+							if (d > distance + 1) {
+								d = uint8_t(distance + 1);
+								buckets[distance + 1].push_back(glm::ivec3(x, y, z));
+							}
+						}
+					}
+				}
+			}
+
+			std::vector<glm::ivec3>().swap(buckets[distance]);
+		}
+	}
+
+	template <typename Layout>
+	bool basic_world<Layout>::findEmptyBox(const glm::ivec3& coord, glm::ivec3& boxMin, glm::ivec3& boxMax) const
+	{
+		// The cube of blocks closer than the nearest solid block
+		int dist = distances.empty() ? 0 : distanceToSolid(coord.x, coord.y, coord.z);
+
+		if (dist > 1) {
+			boxMin = coord - (dist - 1);
+			boxMax = coord + dist;
+			return true;
+		}
+
+		// The largest empty node of the occupancy pyramid
+		int span = emptySpan(coord.x, coord.y, coord.z);
+		if (span == 0) return false;
+
+		boxMin = glm::ivec3(coord.x & ~(span - 1), coord.y & ~(span - 1), coord.z & ~(span - 1));
+		boxMax = boxMin + span;
+
+		return true;
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::markDirty(const box& region)
+	{
+		mergeRegion(dirty, region, MAX_DIRTY_REGIONS);
+	}
+
+	template <typename Layout>
+	void basic_world<Layout>::flushDirty()
+	{
+		// An edit can change the distance of every block up to the limit away from it, but few of them usually do
+		if (!distances.empty()) {
+			for (int i = 0; i < dirty.size(); i++) {
+				if (dirty[i].volume() <= REPAIR_DISTANCE_VOLUME)
+					repairDistances(dirty[i]);
+				else
+					computeDistances(box(dirty[i].min - DISTANCE_LIMIT, dirty[i].max + DISTANCE_LIMIT));
+			}
+		}
+
+		for (int i = 0; i < dirty.size(); i++)
+			journal[journalGeneration++ % JOURNAL_SIZE] = dirty[i];
+
+		dirty.clear();
+	}
+
+	template class basic_world<layout::linear>;
+	template class basic_world<layout::morton>;
+	template class basic_world<layout::tiled>;
 }
\ No newline at end of file
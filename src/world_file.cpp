@@ -0,0 +1,939 @@
+#include <rc/world_file.hpp>
+#include <rc/jobs.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+
+#ifdef _WIN32
+#	define WIN32_LEAN_AND_MEAN
+#	define NOMINMAX
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+namespace rc
+{
+	const uint32_t world_file::VERSION;
+
+	static const char MAGIC[4] = { 'R', 'C', 'W', 'F' };
+	static const char MAPPED_MAGIC[4] = { 'R', 'C', 'W', 'M' };
+
+	// Bytes of the fixed part of the header, of an index entry and of an entry of the brick table of a mappable file
+	static const int HEADER_FIXED_SIZE = 28;
+	static const int INDEX_ENTRY_SIZE = 13;
+	static const int TABLE_ENTRY_SIZE = 16;
+
+	// Brick table entry of a uniform brick
+	static const uint32_t NO_SLOT = 0xffffffff;
+
+	// File material of a current material that the file doesn't have
+	static const uint16_t NO_MATERIAL = 0xffff;
+
+	// Index entries written at once when creating a file
+	static const int CREATE_BATCH = 65536;
+
+	// Largest size of a world along an axis, which keeps the brick count of any file within 64 bits
+	static const int MAX_DIMENSION = 1 << 24;
+
+	// Blocks of a mappable file start on a page boundary, so every brick is a page of its own
+	static const int PAGE_SIZE = 4096;
+
+	static const int BRICK_SIZE = world::BRICK_SIZE;
+	static const int BRICK_VOLUME = world::BRICK_VOLUME;
+
+	// Names in the order of material::material_t
+	static const char* const MATERIAL_NAMES[] = { "empty", "grass", "sand", "stone", "wood", "gold", "cage", "leaf" };
+	static const int MATERIAL_COUNT = sizeof(MATERIAL_NAMES) / sizeof(MATERIAL_NAMES[0]);
+
+	// Shortest match and size of the hash table of the LZ codec
+	static const int LZ_MIN_MATCH = 4;
+	static const int LZ_HASH_BITS = 12;
+
+	static bool seekFile(FILE* f, uint64_t offset)
+	{
+#ifdef _MSC_VER
+		return _fseeki64(f, (__int64) offset, SEEK_SET) == 0;
+#else
+		return fseeko(f, (off_t) offset, SEEK_SET) == 0;
+#endif
+	}
+
+	static uint64_t fileLength(FILE* f)
+	{
+#ifdef _MSC_VER
+		_fseeki64(f, 0, SEEK_END);
+		return (uint64_t) _ftelli64(f);
+#else
+		fseeko(f, 0, SEEK_END);
+		return (uint64_t) ftello(f);
+#endif
+	}
+
+	static void put8(std::vector<uint8_t>& out, uint32_t v) { out.push_back(uint8_t(v)); }
+	static void put16(std::vector<uint8_t>& out, uint32_t v) { put8(out, v); put8(out, v >> 8); }
+	static void put32(std::vector<uint8_t>& out, uint32_t v) { put16(out, v); put16(out, v >> 16); }
+	static void put64(std::vector<uint8_t>& out, uint64_t v) { put32(out, uint32_t(v)); put32(out, uint32_t(v >> 32)); }
+
+	static uint32_t get16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+	static uint32_t get32(const uint8_t* p) { return get16(p) | (get16(p + 2) << 16); }
+	static uint64_t get64(const uint8_t* p) { return get32(p) | (uint64_t(get32(p + 4)) << 32); }
+
+	// Offset of a block inside a brick for a layout ID
+	static int layoutOffset(int id, int x, int y, int z)
+	{
+		if (id == layout::morton::ID) return layout::morton::offset(x, y, z);
+		if (id == layout::tiled::ID) return layout::tiled::offset(x, y, z);
+		return layout::linear::offset(x, y, z);
+	}
+
+	struct header_info
+	{
+		uint32_t headerSize;
+		int sx, sy, sz;
+		int layout;
+		int materialCount;
+		uint64_t brickCount;
+	};
+
+	// Fixed part of the header of a file of size bytes
+	static bool parseHeader(const uint8_t* fixed, const char* magic, uint64_t size, header_info& h)
+	{
+		if (memcmp(fixed, magic, 4) != 0 || get32(fixed + 4) != world_file::VERSION) return false;
+
+		h.headerSize = get32(fixed + 8);
+		h.sx = int(get32(fixed + 12));
+		h.sy = int(get32(fixed + 16));
+		h.sz = int(get32(fixed + 20));
+		h.layout = fixed[25];
+		h.materialCount = get16(fixed + 26);
+
+		if (h.headerSize < HEADER_FIXED_SIZE || h.headerSize > size || fixed[24] != BRICK_SIZE) return false;
+
+		// Sizes are bounded before any brick count is derived from them, and bricks are indexed with an int
+		if (h.sx <= 0 || h.sy <= 0 || h.sz <= 0 || h.sx > MAX_DIMENSION || h.sy > MAX_DIMENSION || h.sz > MAX_DIMENSION) return false;
+
+		h.brickCount = uint64_t((h.sx + BRICK_SIZE - 1) / BRICK_SIZE) * ((h.sy + BRICK_SIZE - 1) / BRICK_SIZE) * ((h.sz + BRICK_SIZE - 1) / BRICK_SIZE);
+		if (h.brickCount > uint64_t(std::numeric_limits<int>::max())) return false;
+
+		// Any other layout would decode into scrambled blocks
+		return h.layout == layout::linear::ID || h.layout == layout::morton::ID || h.layout == layout::tiled::ID;
+	}
+
+	static bool parseMaterialNames(const uint8_t* names, size_t size, int count, std::vector<std::string>& materials)
+	{
+		for (size_t i = 0, pos = 0; i < count; i++) {
+			if (pos >= size || pos + 1 + names[pos] > size) return false;
+
+			materials.push_back(std::string((const char*) &names[pos + 1], names[pos]));
+			pos += 1 + names[pos];
+		}
+
+		return true;
+	}
+
+	// Header of a world with the current materials, with the size of the header filled in
+	static std::vector<uint8_t> makeHeader(const char* magic, int sx, int sy, int sz, int layout)
+	{
+		std::vector<uint8_t> header(magic, magic + 4);
+		put32(header, world_file::VERSION);
+		put32(header, 0);
+		put32(header, sx);
+		put32(header, sy);
+		put32(header, sz);
+		put8(header, BRICK_SIZE);
+		put8(header, layout);
+		put16(header, MATERIAL_COUNT);
+
+		for (int i = 0; i < MATERIAL_COUNT; i++) {
+			put8(header, uint32_t(strlen(MATERIAL_NAMES[i])));
+			header.insert(header.end(), MATERIAL_NAMES[i], MATERIAL_NAMES[i] + strlen(MATERIAL_NAMES[i]));
+		}
+
+		// Size of the header goes after the version now that it's known
+		std::vector<uint8_t> size;
+		put32(size, uint32_t(header.size()));
+		std::copy(size.begin(), size.end(), header.begin() + 8);
+
+		return header;
+	}
+
+	/*
+		Whole file mapped into memory, pages are read when they're first touched
+	*/
+	class file_mapping
+	{
+	public:
+		file_mapping() : data(nullptr), size(0) {}
+
+		~file_mapping()
+		{
+			if (data == nullptr) return;
+
+#ifdef _WIN32
+			UnmapViewOfFile(data);
+#else
+			munmap(data, size);
+#endif
+		}
+
+		// Shared and read-only, or private so that writes to the pages never reach the file
+		bool map(const std::string& path, bool copyOnWrite)
+		{
+#ifdef _WIN32
+			HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (f == INVALID_HANDLE_VALUE) return false;
+
+			LARGE_INTEGER length;
+			HANDLE m = nullptr;
+
+			if (GetFileSizeEx(f, &length) && length.QuadPart > 0 && uint64_t(length.QuadPart) <= size_t(-1)) {
+				m = CreateFileMappingA(f, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+			}
+
+			// The view keeps the file open
+			CloseHandle(f);
+			if (m == nullptr) return false;
+
+			data = (uint8_t*) MapViewOfFile(m, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(m);
+
+			if (data == nullptr) return false;
+			size = size_t(length.QuadPart);
+#else
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0) return false;
+
+			struct stat st;
+			if (fstat(fd, &st) != 0 || st.st_size <= 0 || uint64_t(st.st_size) > size_t(-1)) {
+				::close(fd);
+				return false;
+			}
+
+			void* p = mmap(nullptr, size_t(st.st_size), copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, copyOnWrite ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+			::close(fd);
+
+			if (p == MAP_FAILED) return false;
+
+			data = (uint8_t*) p;
+			size = size_t(st.st_size);
+#endif
+
+			return true;
+		}
+
+		uint8_t* data;
+		size_t size;
+
+	private:
+		file_mapping(const file_mapping&);
+		file_mapping& operator=(const file_mapping&);
+	};
+
+	// Runs of up to 256 equal bytes as a length minus one and the byte, false if that isn't smaller than the input
+	static bool encodeRle(const uint8_t* in, int n, std::vector<uint8_t>& out)
+	{
+		out.clear();
+
+		for (int i = 0; i < n;) {
+			int run = 1;
+			while (i + run < n && run < 256 && in[i + run] == in[i]) run++;
+
+			out.push_back(uint8_t(run - 1));
+			out.push_back(in[i]);
+			i += run;
+
+			if (out.size() >= n) return false;
+		}
+
+		return true;
+	}
+
+	static bool decodeRle(const uint8_t* in, size_t size, uint8_t* out, int n)
+	{
+		int pos = 0;
+
+		for (size_t i = 0; i + 1 < size; i += 2) {
+			int run = in[i] + 1;
+			if (pos + run > n) return false;
+
+			memset(out + pos, in[i + 1], run);
+			pos += run;
+		}
+
+		return pos == n && size % 2 == 0;
+	}
+
+	// Length that doesn't fit in the nibble of a token, as bytes of 255 and the remainder
+	static void putLength(std::vector<uint8_t>& out, int length)
+	{
+		for (; length >= 255; length -= 255)
+			out.push_back(255);
+
+		out.push_back(uint8_t(length));
+	}
+
+	static bool getLength(const uint8_t*& in, const uint8_t* end, int& length)
+	{
+		uint8_t b;
+
+		do {
+			if (in == end) return false;
+			b = *in++;
+			length += b;
+		} while (b == 255);
+
+		return true;
+	}
+
+	static uint32_t read32(const uint8_t* p)
+	{
+		uint32_t v;
+		memcpy(&v, p, 4);
+		return v;
+	}
+
+	/*
+		Sequences of literals followed by a match with an earlier part of the output. Each sequence starts with
+		a token of the number of literals and the match length minus LZ_MIN_MATCH in its high and low nibble,
+		where 15 means that the rest follows as extra bytes. The literals come next, then the distance to the
+		match as a uint16 and the rest of the match length. The last sequence only has literals. A match with
+		a distance of one repeats a single byte, so runs don't need a separate case.
+	*/
+	static bool encodeLz(const uint8_t* in, int n, std::vector<uint8_t>& out)
+	{
+		out.clear();
+
+		// Position plus one of the last occurrence of every hashed 4 byte sequence
+		uint16_t table[1 << LZ_HASH_BITS];
+		memset(table, 0, sizeof(table));
+
+		int anchor = 0;
+
+		for (int i = 0; i + LZ_MIN_MATCH <= n;) {
+			uint32_t seq = read32(in + i);
+			uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+			int candidate = table[h] - 1;
+			table[h] = uint16_t(i + 1);
+
+			if (candidate < 0 || read32(in + candidate) != seq) {
+				i++;
+				continue;
+			}
+
+			int length = LZ_MIN_MATCH;
+			while (i + length < n && in[candidate + length] == in[i + length]) length++;
+
+			int literals = i - anchor;
+			int extra = length - LZ_MIN_MATCH;
+
+			out.push_back(uint8_t((std::min(literals, 15) << 4) | std::min(extra, 15)));
+			if (literals >= 15) putLength(out, literals - 15);
+			out.insert(out.end(), in + anchor, in + i);
+			put16(out, i - candidate);
+			if (extra >= 15) putLength(out, extra - 15);
+
+			i += length;
+			anchor = i;
+
+			if (out.size() >= n) return false;
+		}
+
+		if (anchor < n) {
+			int literals = n - anchor;
+
+			out.push_back(uint8_t(std::min(literals, 15) << 4));
+			if (literals >= 15) putLength(out, literals - 15);
+			out.insert(out.end(), in + anchor, in + n);
+		}
+
+		return out.size() < n;
+	}
+
+	// Smallest encoding of an expanded brick
+	static world_file::codec_t encodeBrick(const uint8_t* blocks, std::vector<uint8_t>& out, std::vector<uint8_t>& scratch)
+	{
+		bool useRle = encodeRle(blocks, BRICK_VOLUME, scratch);
+		bool useLz = encodeLz(blocks, BRICK_VOLUME, out);
+
+		if (useLz && (!useRle || out.size() < scratch.size())) return world_file::LZ;
+
+		if (useRle) {
+			out.swap(scratch);
+			return world_file::RLE;
+		}
+
+		out.assign(blocks, blocks + BRICK_VOLUME);
+		return world_file::RAW;
+	}
+
+	static bool decodeLz(const uint8_t* in, size_t size, uint8_t* out, int n)
+	{
+		const uint8_t* end = in + size;
+		int pos = 0;
+
+		while (pos < n) {
+			if (in == end) return false;
+			uint8_t token = *in++;
+
+			int literals = token >> 4;
+			if (literals == 15 && !getLength(in, end, literals)) return false;
+			if (literals > end - in || pos + literals > n) return false;
+
+			memcpy(out + pos, in, literals);
+			in += literals;
+			pos += literals;
+
+			// Only the last sequence ends the output
+			if (pos == n) break;
+
+			if (end - in < 2) return false;
+			int distance = get16(in);
+			in += 2;
+
+			int length = (token & 15) + LZ_MIN_MATCH;
+			if ((token & 15) == 15 && !getLength(in, end, length)) return false;
+			if (distance == 0 || distance > pos || pos + length > n) return false;
+
+			// Byte by byte, since the match may overlap the output it produces
+			for (int i = 0; i < length; i++, pos++)
+				out[pos] = out[pos - distance];
+		}
+
+		return in == end;
+	}
+
+	world_file::world_file()
+	{
+		file = nullptr;
+		close();
+	}
+
+	world_file::~world_file()
+	{
+		close();
+	}
+
+	bool world_file::open(const std::string& path, bool writable)
+	{
+		close();
+
+		file = fopen(path.c_str(), writable ? "r+b" : "rb");
+		if (file == nullptr) return false;
+
+		this->writable = writable;
+
+		fileSize = fileLength(file);
+
+		// Fixed part of the header, which tells how long the rest of it is
+		uint8_t fixed[HEADER_FIXED_SIZE];
+		header_info h;
+
+		if (!seekFile(file, 0) || fread(fixed, 1, HEADER_FIXED_SIZE, file) != HEADER_FIXED_SIZE || !parseHeader(fixed, MAGIC, fileSize, h)) {
+			close();
+			return false;
+		}
+
+		uint32_t headerSize = h.headerSize;
+		sx = h.sx;
+		sy = h.sy;
+		sz = h.sz;
+		layout = h.layout;
+
+		bsx = (sx + BRICK_SIZE - 1) / BRICK_SIZE;
+		bsy = (sy + BRICK_SIZE - 1) / BRICK_SIZE;
+		bsz = (sz + BRICK_SIZE - 1) / BRICK_SIZE;
+
+		// Material names, matched with the current materials
+		std::vector<uint8_t> names(headerSize - HEADER_FIXED_SIZE);
+		if (!names.empty() && fread(&names[0], 1, names.size(), file) != names.size()) {
+			close();
+			return false;
+		}
+
+		if (!parseMaterialNames(names.empty() ? nullptr : &names[0], names.size(), h.materialCount, materials)) {
+			close();
+			return false;
+		}
+
+		// Materials that don't exist anymore become empty
+		for (int i = 0; i < 256; i++) {
+			materialMap[i] = material::EMPTY;
+			fileMaterials[i] = NO_MATERIAL;
+		}
+
+		for (int i = 0; i < materials.size() && i < 256; i++) {
+			for (int j = 0; j < MATERIAL_COUNT; j++) {
+				if (materials[i] == MATERIAL_NAMES[j]) {
+					materialMap[i] = uint8_t(j);
+					fileMaterials[j] = uint16_t(i);
+				}
+			}
+		}
+
+		identityMap = true;
+		for (int i = 0; i < materials.size() && i < 256; i++)
+			if (materialMap[i] != i) identityMap = false;
+
+		// Index of the bricks, every entry has to point inside the file
+		uint64_t count = h.brickCount;
+		uint64_t dataStart = headerSize + count * INDEX_ENTRY_SIZE;
+		indexStart = headerSize;
+
+		if (dataStart > fileSize) {
+			close();
+			return false;
+		}
+
+		std::vector<uint8_t> entries(size_t(count * INDEX_ENTRY_SIZE));
+		if (fread(&entries[0], 1, entries.size(), file) != entries.size()) {
+			close();
+			return false;
+		}
+
+		index.resize(size_t(count));
+
+		for (size_t i = 0; i < index.size(); i++) {
+			const uint8_t* p = &entries[i * INDEX_ENTRY_SIZE];
+			index_entry& e = index[i];
+
+			e.offset = get64(p);
+			e.size = get32(p + 8);
+			e.codec = codec_t(p[12]);
+
+			if (e.offset < dataStart || e.size == 0 || e.offset + e.size > fileSize || e.codec > LZ) {
+				close();
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void world_file::close()
+	{
+		if (file != nullptr) fclose(file);
+		file = nullptr;
+
+		fileSize = 0;
+		indexStart = 0;
+		writable = false;
+		sx = sy = sz = 0;
+		bsx = bsy = bsz = 0;
+		layout = 0;
+		materials.clear();
+		index.clear();
+
+		for (int i = 0; i < 256; i++) {
+			materialMap[i] = uint8_t(i);
+			fileMaterials[i] = uint16_t(i);
+		}
+
+		identityMap = true;
+	}
+
+	bool world_file::create(const std::string& path, int sx, int sy, int sz, int layoutId)
+	{
+		// The same limits as when opening, so the file can be opened again
+		if (sx <= 0 || sy <= 0 || sz <= 0 || sx > MAX_DIMENSION || sy > MAX_DIMENSION || sz > MAX_DIMENSION) return false;
+		if (layoutId != layout::linear::ID && layoutId != layout::morton::ID && layoutId != layout::tiled::ID) return false;
+
+		uint64_t count = uint64_t((sx + BRICK_SIZE - 1) / BRICK_SIZE) * ((sy + BRICK_SIZE - 1) / BRICK_SIZE) * ((sz + BRICK_SIZE - 1) / BRICK_SIZE);
+		if (count > uint64_t(std::numeric_limits<int>::max())) return false;
+
+		std::vector<uint8_t> header = makeHeader(MAGIC, sx, sy, sz, layoutId);
+		uint64_t dataStart = header.size() + count * INDEX_ENTRY_SIZE;
+
+		FILE* f = fopen(path.c_str(), "wb");
+		if (f == nullptr) return false;
+
+		bool ok = fwrite(&header[0], 1, header.size(), f) == header.size();
+
+		// Every brick gets its own byte of empty material, so it can be rewritten in place later
+		std::vector<uint8_t> entries;
+
+		for (uint64_t i = 0; i < count && ok; i += CREATE_BATCH) {
+			uint64_t n = std::min(count - i, uint64_t(CREATE_BATCH));
+			entries.clear();
+
+			for (uint64_t j = i; j < i + n; j++) {
+				put64(entries, dataStart + j);
+				put32(entries, 1);
+				put8(entries, UNIFORM);
+			}
+
+			ok = fwrite(&entries[0], 1, entries.size(), f) == entries.size();
+		}
+
+		std::vector<uint8_t> empty(CREATE_BATCH, uint8_t(material::EMPTY));
+
+		for (uint64_t i = 0; i < count && ok; i += CREATE_BATCH) {
+			size_t n = size_t(std::min(count - i, uint64_t(CREATE_BATCH)));
+			ok = fwrite(&empty[0], 1, n, f) == n;
+		}
+
+		ok = fclose(f) == 0 && ok;
+
+		return ok;
+	}
+
+	int world_file::blockOffset(int layoutId, int x, int y, int z)
+	{
+		return layoutOffset(layoutId, x, y, z);
+	}
+
+	bool world_file::isOpen() const
+	{
+		return file != nullptr;
+	}
+
+	bool world_file::readBrick(int bx, int by, int bz, uint8_t* blocks, bool& uniform)
+	{
+		if (file == nullptr || bx < 0 || by < 0 || bz < 0 || bx >= bsx || by >= bsy || bz >= bsz) return false;
+
+		// The entry is copied while the file is locked, since writeBrick may replace it
+		std::vector<uint8_t> data;
+		index_entry e;
+
+		{
+			std::lock_guard<std::mutex> lock(fileMutex);
+			e = index[(bz * bsy + by) * bsx + bx];
+			data.resize(e.size);
+
+			if (!seekFile(file, e.offset) || fread(&data[0], 1, e.size, file) != e.size) return false;
+		}
+
+		return decodeBrick(e, &data[0], blocks, uniform);
+	}
+
+	bool world_file::writeBrick(int bx, int by, int bz, const uint8_t* blocks, bool uniform)
+	{
+		if (file == nullptr || !writable || bx < 0 || by < 0 || bz < 0 || bx >= bsx || by >= bsy || bz >= bsz) return false;
+
+		// Blocks with the materials of the file
+		std::vector<uint8_t> mapped(uniform ? 1 : BRICK_VOLUME);
+
+		for (int i = 0; i < mapped.size(); i++) {
+			uint16_t m = fileMaterials[blocks[i]];
+			if (m == NO_MATERIAL) return false;
+
+			mapped[i] = uint8_t(m);
+		}
+
+		index_entry e;
+		std::vector<uint8_t> data, scratch;
+
+		if (uniform) {
+			e.codec = UNIFORM;
+			data.swap(mapped);
+		} else {
+			e.codec = encodeBrick(&mapped[0], data, scratch);
+		}
+
+		e.size = uint32_t(data.size());
+
+		std::vector<uint8_t> entry;
+		size_t i = size_t(bz * bsy + by) * bsx + bx;
+
+		std::lock_guard<std::mutex> lock(fileMutex);
+
+		// Rewrite the old data if the brick still fits, no other brick uses it
+		e.offset = e.size <= index[i].size ? index[i].offset : fileSize;
+
+		put64(entry, e.offset);
+		put32(entry, e.size);
+		put8(entry, e.codec);
+
+		if (!seekFile(file, e.offset) || fwrite(&data[0], 1, data.size(), file) != data.size()) return false;
+		if (!seekFile(file, indexStart + i * INDEX_ENTRY_SIZE) || fwrite(&entry[0], 1, entry.size(), file) != entry.size()) return false;
+
+		index[i] = e;
+		fileSize = std::max(fileSize, e.offset + e.size);
+
+		return true;
+	}
+
+	template <typename Layout>
+	bool world_file::readWorld(basic_world<Layout>& w, int threads)
+	{
+		if (file == nullptr || w.sizeX() != sx || w.sizeY() != sy || w.sizeZ() != sz) return false;
+
+		// All brick data is read at once, it's a fraction of the size of the blocks
+		uint64_t dataStart = fileSize;
+		for (size_t i = 0; i < index.size(); i++)
+			dataStart = std::min(dataStart, index[i].offset);
+
+		std::vector<uint8_t> data(size_t(fileSize - dataStart));
+
+		{
+			std::lock_guard<std::mutex> lock(fileMutex);
+			if (!data.empty() && (!seekFile(file, dataStart) || fread(&data[0], 1, data.size(), file) != data.size())) return false;
+		}
+
+		// Blocks of the world's layout taken from the layout of the file
+		std::vector<uint16_t> order;
+
+		if (layout != Layout::ID) {
+			order.resize(BRICK_VOLUME);
+
+			for (int z = 0; z < BRICK_SIZE; z++)
+				for (int y = 0; y < BRICK_SIZE; y++)
+					for (int x = 0; x < BRICK_SIZE; x++)
+						order[Layout::offset(x, y, z)] = uint16_t(layoutOffset(layout, x, y, z));
+		}
+
+		std::atomic<bool> failed(false);
+
+		w.generateBricks([&] (int bx, int by, int bz, uint8_t* blocks, material::material_t& mat) -> bool {
+			const index_entry& e = index[(bz * bsy + by) * bsx + bx];
+			uint8_t decoded[BRICK_VOLUME];
+			bool uniform;
+
+			if (!decodeBrick(e, &data[size_t(e.offset - dataStart)], order.empty() ? blocks : decoded, uniform)) {
+				failed = true;
+				mat = material::EMPTY;
+				return false;
+			}
+
+			if (uniform) {
+				mat = material::material_t(order.empty() ? blocks[0] : decoded[0]);
+				return false;
+			}
+
+			for (int i = 0; i < order.size(); i++)
+				blocks[i] = decoded[order[i]];
+
+			return true;
+		}, threads);
+
+		return !failed;
+	}
+
+	bool world_file::decodeBrick(const index_entry& e, const uint8_t* data, uint8_t* blocks, bool& uniform) const
+	{
+		uniform = e.codec == UNIFORM;
+
+		switch (e.codec) {
+			case UNIFORM:
+				if (e.size != 1 || data[0] >= materials.size()) return false;
+				blocks[0] = materialMap[data[0]];
+				return true;
+
+			case RAW:
+				if (e.size != BRICK_VOLUME) return false;
+				memcpy(blocks, data, BRICK_VOLUME);
+				break;
+
+			case RLE:
+				if (!decodeRle(data, e.size, blocks, BRICK_VOLUME)) return false;
+				break;
+
+			case LZ:
+				if (!decodeLz(data, e.size, blocks, BRICK_VOLUME)) return false;
+				break;
+		}
+
+		// Blocks can only be materials listed in the header
+		uint8_t highest = *std::max_element(blocks, blocks + BRICK_VOLUME);
+		if (highest >= materials.size()) return false;
+
+		if (!identityMap) {
+			for (int i = 0; i < BRICK_VOLUME; i++)
+				blocks[i] = materialMap[blocks[i]];
+		}
+
+		return true;
+	}
+
+	template <typename Layout>
+	bool saveWorld(const basic_world<Layout>& w, const std::string& path, int threads)
+	{
+		int bsx = w.bricksX(), bsy = w.bricksY(), bsz = w.bricksZ();
+		int count = bsx * bsy * bsz;
+
+		// Compress the bricks in parallel, uniform ones are just their material
+		std::vector<std::vector<uint8_t>> chunks(count);
+		std::vector<uint8_t> codecs(count);
+
+		jobs::shared().parallelFor(0, count, 0, [&] (int begin, int end) {
+			std::vector<uint8_t> scratch;
+
+			for (int i = begin; i < end; i++) {
+				int bx = i % bsx, by = (i / bsx) % bsy, bz = i / (bsx * bsy);
+
+				if (w.isUniformBrick(bx, by, bz)) {
+					codecs[i] = world_file::UNIFORM;
+					chunks[i].assign(1, uint8_t(w.brickMaterial(bx, by, bz)));
+					continue;
+				}
+
+				codecs[i] = encodeBrick(w.brickData(bx, by, bz).data(), chunks[i], scratch);
+			}
+		}, threads);
+
+		std::vector<uint8_t> header = makeHeader(MAGIC, w.sizeX(), w.sizeY(), w.sizeZ(), Layout::ID);
+		uint32_t headerSize = uint32_t(header.size());
+
+		// Index, with the bricks stored in the same order right after it
+		std::vector<uint8_t> entries;
+		entries.reserve(size_t(count) * INDEX_ENTRY_SIZE);
+		uint64_t offset = headerSize + uint64_t(count) * INDEX_ENTRY_SIZE;
+
+		for (int i = 0; i < count; i++) {
+			put64(entries, offset);
+			put32(entries, uint32_t(chunks[i].size()));
+			put8(entries, codecs[i]);
+
+			offset += chunks[i].size();
+		}
+
+		FILE* f = fopen(path.c_str(), "wb");
+		if (f == nullptr) return false;
+
+		bool ok = fwrite(&header[0], 1, header.size(), f) == header.size();
+		ok = ok && fwrite(&entries[0], 1, entries.size(), f) == entries.size();
+
+		for (int i = 0; i < count && ok; i++)
+			ok = fwrite(&chunks[i][0], 1, chunks[i].size(), f) == chunks[i].size();
+
+		ok = fclose(f) == 0 && ok;
+
+		return ok;
+	}
+
+	template <typename Layout>
+	std::unique_ptr<basic_world<Layout>> loadWorld(const std::string& path, int threads)
+	{
+		world_file f;
+		if (!f.open(path)) return std::unique_ptr<basic_world<Layout>>();
+
+		std::unique_ptr<basic_world<Layout>> w(new basic_world<Layout>(f.sizeX(), f.sizeY(), f.sizeZ()));
+		if (!f.readWorld(*w, threads)) return std::unique_ptr<basic_world<Layout>>();
+
+		return w;
+	}
+
+	template <typename Layout>
+	bool saveMappableWorld(const basic_world<Layout>& w, const std::string& path)
+	{
+		int bsx = w.bricksX(), bsy = w.bricksY(), bsz = w.bricksZ();
+		int count = bsx * bsy * bsz;
+
+		std::vector<uint8_t> header = makeHeader(MAPPED_MAGIC, w.sizeX(), w.sizeY(), w.sizeZ(), Layout::ID);
+
+		// Brick table, expanded bricks get the next slot in the data
+		std::vector<uint8_t> table;
+		table.reserve(size_t(count) * TABLE_ENTRY_SIZE);
+		uint32_t slots = 0;
+
+		for (int i = 0; i < count; i++) {
+			int bx = i % bsx, by = (i / bsx) % bsy, bz = i / (bsx * bsy);
+			bool uniform = w.isUniformBrick(bx, by, bz);
+
+			put64(table, w.brickOccupancy(bx, by, bz));
+			put32(table, uniform ? NO_SLOT : slots++);
+			put8(table, uniform ? w.brickMaterial(bx, by, bz) : 0);
+			put8(table, 0);
+			put16(table, 0);
+		}
+
+		size_t end = header.size() + table.size();
+		std::vector<uint8_t> padding((PAGE_SIZE - end % PAGE_SIZE) % PAGE_SIZE, 0);
+
+		FILE* f = fopen(path.c_str(), "wb");
+		if (f == nullptr) return false;
+
+		bool ok = fwrite(&header[0], 1, header.size(), f) == header.size();
+		ok = ok && fwrite(&table[0], 1, table.size(), f) == table.size();
+		ok = ok && (padding.empty() || fwrite(&padding[0], 1, padding.size(), f) == padding.size());
+
+		for (int i = 0; i < count && ok; i++) {
+			int bx = i % bsx, by = (i / bsx) % bsy, bz = i / (bsx * bsy);
+			if (w.isUniformBrick(bx, by, bz)) continue;
+
+			ok = fwrite(w.brickData(bx, by, bz).data(), 1, BRICK_VOLUME, f) == BRICK_VOLUME;
+		}
+
+		ok = fclose(f) == 0 && ok;
+
+		return ok;
+	}
+
+	template <typename Layout>
+	std::unique_ptr<basic_world<Layout>> mapWorld(const std::string& path, bool copyOnWrite)
+	{
+		std::shared_ptr<file_mapping> mapping = std::make_shared<file_mapping>();
+		if (!mapping->map(path, copyOnWrite) || mapping->size < HEADER_FIXED_SIZE) return std::unique_ptr<basic_world<Layout>>();
+
+		const uint8_t* data = mapping->data;
+		header_info h;
+		if (!parseHeader(data, MAPPED_MAGIC, mapping->size, h) || h.layout != Layout::ID) return std::unique_ptr<basic_world<Layout>>();
+
+		// Blocks are used as they are, so the file has to have the current materials in the same order
+		std::vector<std::string> names;
+		if (!parseMaterialNames(data + HEADER_FIXED_SIZE, h.headerSize - HEADER_FIXED_SIZE, h.materialCount, names) || names.size() > MATERIAL_COUNT) {
+			return std::unique_ptr<basic_world<Layout>>();
+		}
+
+		for (int i = 0; i < names.size(); i++)
+			if (names[i] != MATERIAL_NAMES[i]) return std::unique_ptr<basic_world<Layout>>();
+
+		// The table has to be in the file before a world of the size in the header is allocated
+		uint64_t tableEnd = h.headerSize + h.brickCount * TABLE_ENTRY_SIZE;
+		uint64_t dataStart = (tableEnd + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+		if (tableEnd > mapping->size) return std::unique_ptr<basic_world<Layout>>();
+
+		int count = int(h.brickCount);
+
+		uint64_t slots = dataStart < mapping->size ? (mapping->size - dataStart) / BRICK_VOLUME : 0;
+
+		// Only the table is read, the pages of the blocks stay untouched until they're used
+		std::vector<mapped_brick> mapped(count);
+
+		for (int i = 0; i < count; i++) {
+			const uint8_t* e = data + h.headerSize + size_t(i) * TABLE_ENTRY_SIZE;
+			uint32_t slot = get32(e + 8);
+
+			mapped[i].occupancy = get64(e);
+			mapped[i].uniform = material::material_t(e[12]);
+			mapped[i].blocks = nullptr;
+
+			if (slot != NO_SLOT) {
+				if (slot >= slots) return std::unique_ptr<basic_world<Layout>>();
+				mapped[i].blocks = mapping->data + size_t(dataStart) + size_t(slot) * BRICK_VOLUME;
+			} else if (e[12] >= names.size()) {
+				return std::unique_ptr<basic_world<Layout>>();
+			}
+		}
+
+		std::unique_ptr<basic_world<Layout>> w(new basic_world<Layout>(h.sx, h.sy, h.sz));
+		w->mapBricks(mapped, mapping, copyOnWrite);
+
+		return w;
+	}
+
+	template bool world_file::readWorld(basic_world<layout::linear>&, int);
+	template bool world_file::readWorld(basic_world<layout::morton>&, int);
+	template bool world_file::readWorld(basic_world<layout::tiled>&, int);
+
+	template bool saveWorld(const basic_world<layout::linear>&, const std::string&, int);
+	template bool saveWorld(const basic_world<layout::morton>&, const std::string&, int);
+	template bool saveWorld(const basic_world<layout::tiled>&, const std::string&, int);
+
+	template std::unique_ptr<basic_world<layout::linear>> loadWorld(const std::string&, int);
+	template std::unique_ptr<basic_world<layout::morton>> loadWorld(const std::string&, int);
+	template std::unique_ptr<basic_world<layout::tiled>> loadWorld(const std::string&, int);
+
+	template bool saveMappableWorld(const basic_world<layout::linear>&, const std::string&);
+	template bool saveMappableWorld(const basic_world<layout::morton>&, const std::string&);
+	template bool saveMappableWorld(const basic_world<layout::tiled>&, const std::string&);
+
+	template std::unique_ptr<basic_world<layout::linear>> mapWorld(const std::string&, bool);
+	template std::unique_ptr<basic_world<layout::morton>> mapWorld(const std::string&, bool);
+	template std::unique_ptr<basic_world<layout::tiled>> mapWorld(const std::string&, bool);
+}